@@ -0,0 +1,279 @@
+/* 
+ * eventlog.c
+ * Event log of extends, in the crypto agile format of TCG PC Client.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "eventlog.h"
+#include "tpm_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <openssl/evp.h>
+
+#define EVENTLOG_MAX_ALGS 5
+#define EVENTLOG_SPEC_ID "Spec ID Event03"
+
+static const struct {
+  const char* name;
+  uint16_t id; // TPM_ALG_ id.
+} eventlog_algs[] = {
+  {"sha1", 0x0004},
+  {"sha256", 0x000b},
+  {"sha384", 0x000c},
+  {"sha512", 0x000d},
+  {"sm3", 0x0012},
+  {NULL, 0}
+};
+
+struct eventlog {
+  int fd;
+  size_t nmd;
+  uint16_t ids[EVENTLOG_MAX_ALGS];
+  uint16_t sizes[EVENTLOG_MAX_ALGS];
+  size_t pending; // events written but not synced.
+  double oldest; // when the first of them was written.
+  bool failed;
+};
+
+static double eventlog_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned char* eventlog_le16(unsigned char* p, uint16_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  return p + 2;
+}
+
+static unsigned char* eventlog_le32(unsigned char* p, uint32_t v)
+{
+  return eventlog_le16(eventlog_le16(p, v & 0xffff), v >> 16);
+}
+
+static uint32_t eventlog_get32(const unsigned char* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool eventlog_write(int fd, const struct iovec* iov, int n)
+{
+  ssize_t len = 0;
+  int i = 0;
+  for(; i < n; i++)
+    len += iov[i].iov_len;
+  // one writev per event, for O_APPEND to keep it in one piece.
+  return writev(fd, iov, n) == len;
+}
+
+/*
+ * the header, a TCG_PCClientPCREvent of EV_NO_ACTION with the
+ * TCG_EfiSpecIDEvent listing algorithms, as the first event.
+ */
+static bool eventlog_header(eventlog* l)
+{
+  unsigned char buf[32 + 16 + 12 + EVENTLOG_MAX_ALGS * 4 + 1];
+  unsigned char* p = buf;
+  struct iovec iov = {buf, 0};
+  size_t k = 0;
+
+  p = eventlog_le32(p, 0); // pcrIndex
+  p = eventlog_le32(p, EVENTLOG_EV_NO_ACTION);
+  memset(p, 0, 20); // a sha1 digest of zeros.
+  p += 20;
+  p = eventlog_le32(p, 16 + 12 + l->nmd * 4 + 1); // eventSize
+  memset(p, 0, 16);
+  memcpy(p, EVENTLOG_SPEC_ID, sizeof(EVENTLOG_SPEC_ID));
+  p += 16;
+  p = eventlog_le32(p, 0); // platformClass, of clients.
+  *p++ = 0; // specVersionMinor
+  *p++ = 2; // specVersionMajor
+  *p++ = 0; // specErrata
+  *p++ = (sizeof(void*) == 8)? 2: 1; // uintnSize
+  p = eventlog_le32(p, l->nmd);
+  for(; k < l->nmd; k++) {
+    p = eventlog_le16(p, l->ids[k]);
+    p = eventlog_le16(p, l->sizes[k]);
+  }
+  *p++ = 0; // vendorInfoSize
+  iov.iov_len = p - buf;
+  return eventlog_write(l->fd, &iov, 1) && fdatasync(l->fd) == 0;
+}
+
+/*
+ * an existing log must list every algorithm, of the same size.
+ * returns 0 if so, EBADMSG if it does not start with a header, or EINVAL
+ * if an algorithm is missing.
+ */
+static int eventlog_check(eventlog* l)
+{
+  unsigned char buf[4096];
+  ssize_t len = pread(l->fd, buf, sizeof(buf), 0);
+  uint32_t n = 0;
+  size_t k = 0;
+  const unsigned char* spec = buf + 32;
+  if(len < 0)
+    return errno;
+  if(len < 32 + 16 + 12
+     || eventlog_get32(buf + 4) != EVENTLOG_EV_NO_ACTION
+     || 0 != memcmp(spec, EVENTLOG_SPEC_ID, sizeof(EVENTLOG_SPEC_ID)))
+    return EBADMSG;
+  n = eventlog_get32(spec + 24);
+  if(n > (len - (32 + 16 + 12)) / 4)
+    return EBADMSG;
+  for(; k < l->nmd; k++) {
+    uint32_t i = 0;
+    for(; i < n; i++) {
+      const unsigned char* a = spec + 28 + i * 4;
+      if((a[0] | (a[1] << 8)) == l->ids[k]
+	 && (a[2] | (a[3] << 8)) == l->sizes[k])
+	break;
+    }
+    if(i == n)
+      return EINVAL;
+  }
+  return 0;
+}
+
+eventlog* eventlog_open(const char* path, const char* const* mds, size_t nmd)
+{
+  eventlog* l = NULL;
+  struct stat st;
+  size_t k = 0;
+  int err = 0;
+  if(nmd == 0 || nmd > EVENTLOG_MAX_ALGS) {
+    errno = ENOTSUP;
+    return NULL;
+  }
+  l = (eventlog*)calloc(1, sizeof(*l));
+  if(l == NULL)
+    return NULL;
+
+  l->nmd = nmd;
+  for(; k < nmd; k++) {
+    const EVP_MD* md = EVP_get_digestbyname(mds[k]);
+    size_t i = 0;
+    for(; eventlog_algs[i].name && 0 != strcmp(eventlog_algs[i].name, mds[k]);
+	i++);
+    if(md == NULL || eventlog_algs[i].name == NULL) {
+      free(l);
+      errno = ENOTSUP;
+      return NULL;
+    }
+    l->ids[k] = eventlog_algs[i].id;
+    l->sizes[k] = EVP_MD_size(md);
+  }
+
+  do {
+    l->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(l->fd < 0 || flock(l->fd, LOCK_EX) != 0 || fstat(l->fd, &st) != 0)
+      break;
+    if(st.st_size == 0 && !eventlog_header(l))
+      break;
+    if(st.st_size != 0 && (err = eventlog_check(l)) != 0) {
+      errno = err;
+      break;
+    }
+    return l;
+  } while(0);
+
+  err = errno;
+  if(l->fd >= 0)
+    close(l->fd);
+  free(l);
+  errno = err;
+  return NULL;
+}
+
+static bool eventlog_sync(eventlog* l)
+{
+  if(l->pending == 0)
+    return true;
+  l->pending = 0;
+  if(fdatasync(l->fd) != 0)
+    l->failed = true;
+  return !l->failed;
+}
+
+bool eventlog_append(eventlog* l, uint32_t pcr_index, uint32_t type,
+		     const char* digests, const char* data, size_t datalen)
+{
+  unsigned char buf[12 + EVENTLOG_MAX_ALGS * (2 + PCRSIZE) + 4];
+  unsigned char* p = buf;
+  struct iovec iov[2];
+  size_t k = 0;
+
+  p = eventlog_le32(p, pcr_index);
+  p = eventlog_le32(p, type);
+  p = eventlog_le32(p, l->nmd); // TPML_DIGEST_VALUES
+  for(; k < l->nmd; k++) {
+    p = eventlog_le16(p, l->ids[k]);
+    memcpy(p, digests, l->sizes[k]);
+    p += l->sizes[k];
+    digests += l->sizes[k];
+  }
+  p = eventlog_le32(p, datalen);
+  iov[0] = (struct iovec){buf, p - buf};
+  iov[1] = (struct iovec){(void*)data, datalen};
+  if(!eventlog_write(l->fd, iov, 2)) {
+    l->failed = true;
+    return false;
+  }
+
+  // group commit.
+  if(l->pending ++ == 0)
+    l->oldest = eventlog_now();
+  if(l->pending >= EVENTLOG_COMMIT_EVENTS
+     || eventlog_now() - l->oldest >= EVENTLOG_COMMIT_MS / 1e3)
+    return eventlog_sync(l);
+  return true;
+}
+
+bool eventlog_close(eventlog* l)
+{
+  bool ok = false;
+  if(l == NULL)
+    return true;
+  ok = eventlog_sync(l) && !l->failed;
+  close(l->fd);
+  free(l);
+  return ok;
+}
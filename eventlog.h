@@ -0,0 +1,92 @@
+/* 
+ * eventlog.h
+ * Event log of extends, in the crypto agile format of TCG PC Client.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _EVENTLOG_H_
+#define _EVENTLOG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Extends are logged as TCG_PCR_EVENT2s, with the digest of every bank
+ * and the path measured as event data, after the Spec ID Event03 header
+ * listing algorithms of the log, as firmware logs them, so the log could
+ * be replayed by verifiers of those. The log is only appended to, and is
+ * locked for as long as it is open, for extends of other processes not
+ * to interleave with ones logged. An event is written before its extend
+ * is sent; events are made durable with an fdatasync of a group of them,
+ * of up to EVENTLOG_COMMIT_EVENTS, or EVENTLOG_COMMIT_MS old, and at
+ * close.
+ */
+
+#define EVENTLOG_EV_NO_ACTION 0x00000003
+#define EVENTLOG_EV_IPL 0x0000000d
+
+#define EVENTLOG_COMMIT_EVENTS 64
+#define EVENTLOG_COMMIT_MS 50
+
+typedef struct eventlog eventlog;
+
+/*
+ * open the log at path, created with the algorithms mds (of openssl
+ * names) if missing or empty; an existing log must list all of them.
+ * returns NULL with errno set if not: ENOTSUP for algorithms a log could
+ * not hold, EBADMSG for a file not starting with a log header, and
+ * EINVAL for a log missing one of mds.
+ */
+eventlog* eventlog_open(const char* path, const char* const* mds, size_t nmd);
+
+// digests of all algorithms given to open, one after another.
+bool eventlog_append(eventlog* l, uint32_t pcr_index, uint32_t type,
+		     const char* digests, const char* data, size_t datalen);
+
+// syncs the events not yet synced; false if the sync or any write failed.
+bool eventlog_close(eventlog* l);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
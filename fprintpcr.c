@@ -35,9 +35,15 @@
 #include "tpm_common.h"
 
 int fprintpcr(FILE* fp, uint32_t pcr_index, const pcr* pcr_content)
+{
+  return fprintpcr_bank(fp, pcr_index, "", pcr_content);
+}
+
+int fprintpcr_bank(FILE* fp, uint32_t pcr_index, const char* bank,
+		   const pcr* pcr_content)
 {
   int res = 0;
-  res += fprintf(fp, "PCR %u:", pcr_index);
+  res += fprintf(fp, "PCR %u:%s", pcr_index, bank);
   {
     int i;
     for(i = 0; i < pcr_content->s; i++){
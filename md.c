@@ -32,54 +32,795 @@
  * files in the program, then also delete it here.
  */
 
+#define _GNU_SOURCE // for O_DIRECT
 #include "md.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 MDBIO* MDBIO_new(const char* mdname)
 {
-  BIO* ret = BIO_new(BIO_f_md());
-  if(!ret)
-    return NULL;
-  if(!BIO_set_md(ret, EVP_get_digestbyname(mdname))){
-    BIO_free(ret);
-    return NULL;
-  }
-  return ret;
+  return MDSET_new(&mdname, 1);
+}
+
+void MDBIO_free(MDBIO* b)
+{
+  MDSET_free(b);
 }
 
 size_t MDBIO_md_size(MDBIO* b)
 {
-  const EVP_MD* mdvt = NULL;
-  if(false == BIO_get_md(b, &mdvt))
-    return 0;
-  return EVP_MD_size(mdvt);
+  return MDSET_md_size(b, 0);
+}
+
+int MDBIO_getmd(MDBIO* b, char* buf, size_t size)
+{
+  return MDSET_getmd(b, 0, buf, size);
 }
 
 size_t MDBIO_feed_file(MDBIO* b, FILE* f, size_t buff_size)
 {
-  char* buff = (char*)malloc(buff_size);
+  return MDSET_feed_file(b, f, buff_size, MDBIO_IO_READ);
+}
 
-  if(buff == NULL) // malloc failed
-    return 0;// please check errno.
+static const char* const iomode_names[] = {
+  [MDBIO_IO_READ] = "read",
+  [MDBIO_IO_MMAP] = "mmap",
+  [MDBIO_IO_URING] = "uring",
+  [MDBIO_IO_URING_DIRECT] = "uring-direct",
+};
 
-  BIO* bf = BIO_new_fp(f, false);//do not close f when closing bf
-  if(bf == NULL)
-    return 0;// please chech ERR.
+bool MDBIO_iomode_byname(const char* name, MDBIO_iomode* mode)
+{
+  size_t i = 0;
+  for(; i < sizeof(iomode_names)/sizeof(iomode_names[0]); i++) {
+    if(0 == strcmp(name, iomode_names[i])) {
+      *mode = (MDBIO_iomode)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* MDBIO_iomode_name(MDBIO_iomode mode)
+{
+  return iomode_names[mode];
+}
 
-  BIO_push(b, bf);
+/*
+ * Sources of file content push what they read into a sink, and take their
+ * buffers from an arena, which is kept by the caller for the next file.
+ */
+#define FP_md_sink(x) int (x)(void* arg, const void* data, size_t len)
+typedef FP_md_sink(fp_md_sink);
+
+// what the sources other than read return, instead of the bytes fed.
+#define MD_FEED_FALLBACK ((ssize_t)-1)
+#define MD_FEED_ERROR ((ssize_t)-2)
+
+static char* md_arena_get(md_arena* a, size_t size)
+{
+  size = (size + MDBIO_URING_ALIGN - 1) & ~(MDBIO_URING_ALIGN - 1);
+  if(a->buf != NULL && a->size >= size)
+    return a->buf;
+  free(a->buf);
+  a->buf = (char*)aligned_alloc(MDBIO_URING_ALIGN, size);
+  a->size = (a->buf != NULL)? size: 0;
+  return a->buf;
+}
 
-  int rdlen = 0;
+/*
+ * returns MD_FEED_FALLBACK if f could not be mapped at all, and the caller
+ * should read it instead, or MD_FEED_ERROR if it fails partway.
+ */
+static ssize_t md_feed_mmap(FILE* f, fp_md_sink* sink, void* arg)
+{
+  struct stat st;
+  int fd = fileno(f);
+
+  if((fd < 0)
+     || (fstat(fd, &st) != 0)
+     || !S_ISREG(st.st_mode)
+     || (st.st_size == 0) // may be a procfs or sysfs file, read it.
+     || (ftello(f) != 0))
+    return MD_FEED_FALLBACK;
+
+  ssize_t total = 0;
+  off_t off = 0;
+  while(off < st.st_size) {
+    size_t len = ((st.st_size - off) < MDBIO_MMAP_WINDOW)?
+      (size_t)(st.st_size - off):
+      (size_t)MDBIO_MMAP_WINDOW;
+    /*
+     * MAP_POPULATE faults the whole window in with one syscall, and
+     * MADV_SEQUENTIAL lets the kernel drop pages behind us early.
+     */
+    void* p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, off);
+    if(p == MAP_FAILED) {
+      if(total == 0) // the filesystem may not support mmap at all.
+	return MD_FEED_FALLBACK;
+      return MD_FEED_ERROR;// please check errno.
+    }
+    madvise(p, len, MADV_SEQUENTIAL);
+
+    int ok = sink(arg, p, len);
+    munmap(p, len);
+    if(!ok)
+      return MD_FEED_ERROR;// please check ERR.
+
+    total += len;
+    off += len;
+  }
+
+  return total;
+}
+
+static size_t md_feed_read(FILE* f, char* buff, size_t buff_size,
+			   fp_md_sink* sink, void* arg)
+{
+  size_t rdlen = 0;
   size_t total = 0;
   do {
-    rdlen = BIO_read(b, buff, buff_size);
+    rdlen = fread(buff, 1, buff_size, f);
+    if(rdlen > 0 && !sink(arg, buff, rdlen))
+      return MDBIO_FEED_FAILED;// please check ERR.
     total += rdlen;
   } while(rdlen > 0);
 
-  //do cleaning here.
+  if(ferror(f))
+    return MDBIO_FEED_FAILED;// please check errno.
+  return total;
+}
+
+/*
+ * io_uring is driven with raw syscalls, as liburing does, to keep
+ * MDBIO_URING_DEPTH reads of buff_size bytes in flight, while the digest
+ * consumes completed buffers in the order of their offsets.
+ */
+typedef struct md_uring {
+  int fd;
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  void* sq_ring;
+  size_t sq_ring_len;
+  void* cq_ring;
+  size_t cq_ring_len;
+  size_t sqes_len;
+} md_uring;
+
+static void md_uring_teardown(md_uring* u)
+{
+  if(u->sqes != NULL)
+    munmap(u->sqes, u->sqes_len);
+  if(u->cq_ring != NULL && u->cq_ring != u->sq_ring)
+    munmap(u->cq_ring, u->cq_ring_len);
+  if(u->sq_ring != NULL)
+    munmap(u->sq_ring, u->sq_ring_len);
+  close(u->fd);
+}
+
+static int md_uring_setup(md_uring* u, unsigned int depth)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(u, 0, sizeof(*u));
+
+  u->fd = syscall(__NR_io_uring_setup, depth, &p);
+  if(u->fd < 0)
+    return -1;// please check errno.
+
+  u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  u->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if((p.features & IORING_FEAT_SINGLE_MMAP)
+     && (u->cq_ring_len > u->sq_ring_len))
+    u->sq_ring_len = u->cq_ring_len;
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  do {
+    void* ptr = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if(ptr == MAP_FAILED)
+      break;
+    u->sq_ring = ptr;
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+      u->cq_ring = u->sq_ring;
+    } else {
+      ptr = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+      if(ptr == MAP_FAILED)
+	break;
+      u->cq_ring = ptr;
+    }
+
+    ptr = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+	       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if(ptr == MAP_FAILED)
+      break;
+    u->sqes = (struct io_uring_sqe*)ptr;
+
+    u->sq_tail = (unsigned int*)((char*)u->sq_ring + p.sq_off.tail);
+    u->sq_mask = (unsigned int*)((char*)u->sq_ring + p.sq_off.ring_mask);
+    u->sq_array = (unsigned int*)((char*)u->sq_ring + p.sq_off.array);
+    u->cq_head = (unsigned int*)((char*)u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned int*)((char*)u->cq_ring + p.cq_off.tail);
+    u->cq_mask = (unsigned int*)((char*)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)((char*)u->cq_ring + p.cq_off.cqes);
+    return 0;
+  } while(0);
+
+  md_uring_teardown(u);
+  return -1;
+}
+
+static int md_uring_read(md_uring* u, int fd, void* buf, size_t len,
+			 off_t off, uint64_t data)
+{
+  unsigned int tail = *u->sq_tail; // only we move the tail.
+  unsigned int idx = tail & *u->sq_mask;
+  struct io_uring_sqe* sqe = &u->sqes[idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->user_data = data;
+  u->sq_array[idx] = idx;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  return (syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0) == 1)? 0: -1;
+}
+
+static int md_uring_wait(md_uring* u, struct io_uring_cqe* cqe)
+{
+  for(;;) {
+    unsigned int head = *u->cq_head;
+    if(head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+      *cqe = u->cqes[head & *u->cq_mask];
+      __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+      return 0;
+    }
+    if(syscall(__NR_io_uring_enter, u->fd, 0, 1,
+	       IORING_ENTER_GETEVENTS, NULL, 0) < 0
+       && errno != EINTR)
+      return -1;
+  }
+}
+
+typedef struct md_uring_slot {
+  off_t off;
+  size_t got;
+  bool done;
+} md_uring_slot;
+
+/*
+ * returns MD_FEED_FALLBACK if f could not be read with io_uring before
+ * anything is fed into the sink, and the caller should read it in the
+ * common way instead, or MD_FEED_ERROR if it fails partway.
+ */
+static ssize_t md_feed_uring(FILE* f, size_t buff_size, bool direct,
+			     md_arena* arena, fp_md_sink* sink, void* arg)
+{
+  struct stat st;
+  int fd = fileno(f);
+
+  if((fd < 0)
+     || (fstat(fd, &st) != 0)
+     || !S_ISREG(st.st_mode)
+     || (st.st_size == 0)
+     || (ftello(f) != 0))
+    return MD_FEED_FALLBACK;
+
+  // O_DIRECT needs aligned buffers, lengths and offsets.
+  size_t bsize = (buff_size + MDBIO_URING_ALIGN - 1) & ~(MDBIO_URING_ALIGN - 1);
+  int rfd = fd;
+  if(direct) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    rfd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if(rfd < 0) // e.g. tmpfs does not support O_DIRECT.
+      rfd = fd;
+  }
+
+  md_uring u;
+  char* pool = md_arena_get(arena, bsize * MDBIO_URING_DEPTH);
+  if(pool == NULL || md_uring_setup(&u, MDBIO_URING_DEPTH) != 0) {
+    if(rfd != fd)
+      close(rfd);
+    return MD_FEED_FALLBACK;
+  }
+
+  md_uring_slot slot[MDBIO_URING_DEPTH];
+  off_t next_off = 0;
+  size_t head = 0; // slots are used round-robin, head is hashed next.
+  size_t inflight = 0;
+  ssize_t total = 0;
+  bool failed = false;
+  bool fed = false;
+
+  {
+    size_t i = 0;
+    for(; i < MDBIO_URING_DEPTH && next_off < st.st_size; i++) {
+      slot[i] = (md_uring_slot){next_off, 0, false};
+      if(md_uring_read(&u, rfd, pool + i * bsize, bsize, next_off, i) != 0) {
+	failed = true;
+	break;
+      }
+      next_off += bsize;
+      inflight ++;
+    }
+    for(; i < MDBIO_URING_DEPTH; i++)
+      slot[i] = (md_uring_slot){0, 0, false};
+  }
+
+  while(inflight > 0 && !failed) {
+    struct io_uring_cqe cqe;
+    if(md_uring_wait(&u, &cqe) != 0) {
+      failed = true;
+      break;
+    }
+    inflight --;
+
+    size_t i = cqe.user_data;
+    if(cqe.res < 0) {
+      errno = -cqe.res;
+      failed = true;
+      break;
+    }
+    size_t got = slot[i].got;
+    slot[i].got += cqe.res;
+    if((cqe.res > 0)
+       && (slot[i].got < bsize)
+       && (slot[i].off + (off_t)slot[i].got < st.st_size)) {
+      /*
+       * a short read in the middle of the file, read the rest. O_DIRECT
+       * takes aligned offsets only, so read again from the last one.
+       */
+      if(rfd != fd) {
+	slot[i].got &= ~(MDBIO_URING_ALIGN - 1);
+	if(slot[i].got == got) {
+	  errno = EIO;
+	  failed = true;
+	  break;
+	}
+      }
+      if(md_uring_read(&u, rfd, pool + i * bsize + slot[i].got,
+		       bsize - slot[i].got, slot[i].off + slot[i].got, i) != 0) {
+	failed = true;
+	break;
+      }
+      inflight ++;
+      continue;
+    }
+    if((slot[i].got != bsize)
+       && (slot[i].off + (off_t)slot[i].got != st.st_size)) {
+      errno = EIO; // the file was truncated or grew while being read.
+      failed = true;
+      break;
+    }
+    slot[i].done = true;
+
+    while(slot[head].done && !failed) {
+      fed = true;
+      if(slot[head].got > 0 && !sink(arg, pool + head * bsize, slot[head].got)) {
+	failed = true;
+	break;
+      }
+      total += slot[head].got;
+      slot[head].done = false;
+      if(next_off < st.st_size) {
+	slot[head] = (md_uring_slot){next_off, 0, false};
+	if(md_uring_read(&u, rfd, pool + head * bsize, bsize, next_off, head) != 0) {
+	  failed = true;
+	  break;
+	}
+	next_off += bsize;
+	inflight ++;
+      }
+      head = (head + 1) % MDBIO_URING_DEPTH;
+    }
+  }
+
+  // the kernel must not write into buffers after they are freed.
   {
-    BIO_pop(bf);
-    BIO_free(bf);
-    free(buff);
+    struct io_uring_cqe cqe;
+    for(; inflight > 0; inflight --) {
+      if(md_uring_wait(&u, &cqe) != 0)
+	break;
+    }
+  }
+
+  /*
+   * reads still in flight are cancelled asynchronously after the ring is
+   * closed, and may land in the buffers later, so if waiting for them
+   * failed, the arena is leaked rather than freed under the kernel.
+   */
+  md_uring_teardown(&u);
+  if(inflight != 0)
+    *arena = (md_arena){NULL, 0};
+  if(rfd != fd)
+    close(rfd);
+
+  if(failed)
+    return fed? MD_FEED_ERROR: MD_FEED_FALLBACK;
+  if(total != st.st_size) {
+    errno = EIO;
+    return MD_FEED_ERROR;
   }
-  
   return total;
 }
+
+static size_t md_feed(FILE* f, size_t buff_size, MDBIO_iomode mode,
+		      md_arena* arena, fp_md_sink* sink, void* arg)
+{
+  ssize_t r = -1;
+  switch(mode) {
+  case MDBIO_IO_MMAP:
+    r = md_feed_mmap(f, sink, arg);
+    break;
+  case MDBIO_IO_URING:
+  case MDBIO_IO_URING_DIRECT:
+    r = md_feed_uring(f, buff_size, mode == MDBIO_IO_URING_DIRECT,
+		      arena, sink, arg);
+    break;
+  case MDBIO_IO_READ:
+  default:
+    break;
+  }
+  if(r >= 0)
+    return r;
+  if(r != MD_FEED_FALLBACK)
+    return MDBIO_FEED_FAILED;
+
+  char* buff = md_arena_get(arena, buff_size);
+  if(buff == NULL) // malloc failed
+    return MDBIO_FEED_FAILED;// please check errno.
+
+  return md_feed_read(f, buff, buff_size, sink, arg);
+}
+
+size_t MDBIO_feed_file_mmap(MDBIO* b, FILE* f, size_t buff_size)
+{
+  return MDBIO_feed_file_iomode(b, f, buff_size, MDBIO_IO_MMAP);
+}
+
+size_t MDBIO_feed_file_iomode(MDBIO* b, FILE* f, size_t buff_size,
+			      MDBIO_iomode mode)
+{
+  return MDSET_feed_file(b, f, buff_size, mode);
+}
+
+MDSET* MDSET_new(const char* const* mdnames, size_t num)
+{
+  if(num == 0 || num > MDSET_MAX)
+    return NULL;
+
+  MDSET* s = (MDSET*)calloc(1, sizeof(MDSET));
+  if(s == NULL)
+    return NULL;
+
+  for(; s->num < num; s->num ++) {
+    size_t i = s->num;
+    s->md[i] = EVP_get_digestbyname(mdnames[i]);
+    if(s->md[i] == NULL)
+      break;
+    s->ctx[i] = EVP_MD_CTX_new();
+    if(s->ctx[i] == NULL)
+      break;
+    if(!EVP_DigestInit_ex(s->ctx[i], s->md[i], NULL)) {
+      EVP_MD_CTX_free(s->ctx[i]);
+      break;
+    }
+  }
+
+  if(s->num != num) {
+    MDSET_free(s);
+    return NULL;// please check ERR.
+  }
+  return s;
+}
+
+void MDSET_free(MDSET* s)
+{
+  if(s == NULL)
+    return;
+  {
+    size_t i = 0;
+    for(; i < s->num; i++)
+      EVP_MD_CTX_free(s->ctx[i]);
+  }
+  free(s->arena.buf);
+  free(s);
+}
+
+size_t MDSET_md_size(const MDSET* s, size_t i)
+{
+  return EVP_MD_size(s->md[i]);
+}
+
+static FP_md_sink(md_sink_set)
+{
+  MDSET* s = (MDSET*)arg;
+  size_t i = 0;
+  s->bytes += len;
+  for(; i < s->num; i++) {
+    if(!EVP_DigestUpdate(s->ctx[i], data, len))
+      return 0;
+  }
+  return 1;
+}
+
+int MDSET_update(MDSET* s, const void* data, size_t len)
+{
+  return md_sink_set(s, data, len);
+}
+
+int MDSET_update_one(MDSET* s, size_t i, const void* data, size_t len)
+{
+  s->bytes += len;
+  return EVP_DigestUpdate(s->ctx[i], data, len);
+}
+
+size_t MDSET_feed_file(MDSET* s, FILE* f, size_t buff_size,
+		       MDBIO_iomode mode)
+{
+  return md_feed(f, buff_size, mode, &s->arena, md_sink_set, s);
+}
+
+size_t MDSET_digest_file(MDSET* s, FILE* f, size_t buff_size,
+			 MDBIO_iomode mode, char* buf, size_t size)
+{
+  struct stat st;
+  off_t start = ftello(f);
+  bool sized = (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)
+		&& st.st_size > 0 && start >= 0);
+  size_t fed = MDSET_feed_file(s, f, buff_size, mode);
+  // finish the digests anyway, to reset them for the next file.
+  size_t total = MDSET_getmds(s, buf, size);
+
+  if(fed == MDBIO_FEED_FAILED)
+    return 0;// please check errno or ERR.
+  if(sized && fed != (uint64_t)(st.st_size - start)) {
+    errno = EIO; // the file changed size while being read.
+    return 0;
+  }
+  return total;
+}
+
+static int md_write_all(int fd, const char* buff, size_t len)
+{
+  while(len > 0) {
+    ssize_t w = write(fd, buff, len);
+    if(w < 0 && errno == EINTR)
+      continue;
+    if(w <= 0)
+      return -1;
+    buff += w;
+    len -= w;
+  }
+  return 0;
+}
+
+static ssize_t md_read_full(int fd, char* buff, size_t len)
+{
+  size_t got = 0;
+  while(got < len) {
+    ssize_t r = read(fd, buff + got, len - got);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r < 0)
+      return -1;
+    if(r == 0)
+      break;
+    got += r;
+  }
+  return got;
+}
+
+/*
+ * move len bytes from pipe to out, with splice(2) until out refuses it
+ * (e.g. opened with O_APPEND), then through buff.
+ */
+static int md_splice_all(int pipe, int out, size_t len,
+			 char* buff, bool* nosplice)
+{
+  while(len > 0) {
+    ssize_t r = 0;
+    if(!*nosplice) {
+      r = splice(pipe, NULL, out, NULL, len, SPLICE_F_MOVE);
+      if(r < 0 && errno == EINVAL) {
+	*nosplice = true;
+	continue;
+      }
+    } else {
+      r = read(pipe, buff, len);
+      if(r > 0 && md_write_all(out, buff, r) != 0)
+	return -1;
+    }
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0)
+      return -1;
+    len -= r;
+  }
+  return 0;
+}
+
+// buff_size, up to what an unprivileged process may set a pipe to.
+static int md_pipe_size(size_t buff_size)
+{
+  unsigned long max = 1 << 20; // the default of fs.pipe-max-size.
+  FILE* f = fopen("/proc/sys/fs/pipe-max-size", "r");
+  if(f != NULL) {
+    if(fscanf(f, "%lu", &max) != 1)
+      max = 1 << 20;
+    fclose(f);
+  }
+  if(max > INT_MAX)
+    max = INT_MAX;
+  return (buff_size < max)? (int)buff_size: (int)max;
+}
+
+ssize_t MDSET_feed_stream(MDSET* s, int in, int out, size_t buff_size)
+{
+  struct stat st;
+  int mid[2] = {-1, -1};
+  bool teeing = false;
+  bool nosplice = false;
+  bool eof = false;
+  bool failed = false;
+  ssize_t total = 0;
+  char* buff = md_arena_get(&s->arena, buff_size);
+  if(buff == NULL)
+    return -1;
+
+  if(fstat(in, &st) == 0 && S_ISFIFO(st.st_mode)
+     && fstat(out, &st) == 0) {
+    teeing = S_ISFIFO(st.st_mode) || (pipe2(mid, O_CLOEXEC) == 0);
+    /*
+     * a larger internal pipe takes fewer rounds, it is fine if it is not
+     * allowed. pipes of the caller are left as they are.
+     */
+    if(mid[1] >= 0)
+      fcntl(mid[1], F_SETPIPE_SZ, md_pipe_size(buff_size));
+  }
+
+  while(teeing && !failed) {
+    ssize_t n = tee(in, (mid[1] >= 0)? mid[1]: out, buff_size, 0);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0 && errno == EINVAL && total == 0) {
+      teeing = false; // tee is not supported, copy instead.
+      break;
+    }
+    if(n <= 0) {
+      eof = (n == 0);
+      failed = (n < 0);
+      break;
+    }
+    // the data is on its way out, now take it from in to hash.
+    if((mid[0] >= 0 && md_splice_all(mid[0], out, n, buff, &nosplice) != 0)
+       || (md_read_full(in, buff, n) != n)
+       || !MDSET_update(s, buff, n)) {
+      failed = true;
+      break;
+    }
+    total += n;
+    if(nosplice) // out could only be written, copy the rest as well.
+      break;
+  }
+
+  while(!eof && !failed) {
+    ssize_t n = read(in, buff, buff_size);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0) {
+      failed = (n < 0);
+      break;
+    }
+    if((md_write_all(out, buff, n) != 0)
+       || !MDSET_update(s, buff, n)) {
+      failed = true;
+      break;
+    }
+    total += n;
+  }
+
+  if(mid[0] >= 0) {
+    int err = errno;
+    close(mid[0]);
+    close(mid[1]);
+    errno = err;
+  }
+  return failed? -1: total;
+}
+
+int MDSET_getmd(MDSET* s, size_t i, char* buf, size_t size)
+{
+  unsigned int len = 0;
+  if(size < (size_t)EVP_MD_size(s->md[i]))
+    return 0;
+  if(!EVP_DigestFinal_ex(s->ctx[i], (unsigned char*)buf, &len))
+    return 0;
+  // get ready for the next file.
+  if(!EVP_DigestInit_ex(s->ctx[i], s->md[i], NULL))
+    return 0;
+  return len;
+}
+
+size_t MDSET_getmds(MDSET* s, char* buf, size_t size)
+{
+  size_t total = 0;
+  size_t i = 0;
+  for(; i < s->num; i++) {
+    int len = MDSET_getmd(s, i, buf + total, size - total);
+    if(len <= 0)
+      return 0;
+    total += len;
+  }
+  return total;
+}
+
+size_t MD_extend(const char* mdname, char* value, size_t size,
+		 const char* data, size_t len)
+{
+  const EVP_MD* md = EVP_get_digestbyname(mdname);
+  unsigned int l = 0;
+  if(md == NULL || (size_t)EVP_MD_size(md) != size)
+    return 0;
+
+  EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
+  if(mdctx == NULL)
+    return 0;
+  if(!EVP_DigestInit_ex(mdctx, md, NULL)
+     || !EVP_DigestUpdate(mdctx, value, size)
+     || !EVP_DigestUpdate(mdctx, data, len)
+     || !EVP_DigestFinal_ex(mdctx, (unsigned char*)value, &l))
+    l = 0;
+  EVP_MD_CTX_free(mdctx);
+  return l;
+}
+
+bool MD_parse_size(const char* s, size_t* size)
+{
+  char* end = NULL;
+  unsigned int shift = 0;
+  errno = 0;
+  unsigned long long v = strtoull(s, &end, 0);
+  if(errno != 0 || end == s || strchr(s, '-') != NULL)
+    return false;
+  switch(*end) {
+  case 'g': case 'G':
+    shift += 10;
+    /* fall through */
+  case 'm': case 'M':
+    shift += 10;
+    /* fall through */
+  case 'k': case 'K':
+    shift += 10;
+    end ++;
+    /* fall through */
+  case '\0':
+    break;
+  default:
+    return false;
+  }
+  if(*end != '\0' || v == 0 || v > (SIZE_MAX >> shift))
+    return false;
+  *size = (size_t)v << shift;
+  return true;
+}
@@ -50,6 +50,8 @@ extern "C" {
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 static inline int OSSL_init(void)
 {
@@ -64,19 +66,136 @@ static inline void OSSL_uninit(void)
   EVP_cleanup();
 }
 
-typedef BIO MDBIO;
+/*
+ * A MDBIO is a MDSET of a single algorithm, see below. MDBIO_getmd()
+ * finishes the digest and resets it for the next file, so a MDBIO could
+ * be reused for any number of files.
+ */
+typedef struct MDSET MDBIO;
 
 MDBIO* MDBIO_new(const char* mdname);
+void MDBIO_free(MDBIO* b);
 size_t MDBIO_md_size(MDBIO* b);
-static inline int MDBIO_getmd(MDBIO* b, char* buf, size_t size)
-{
-  int ret = BIO_gets(b, buf, size);
-  BIO_reset(b);
-  return ret;
-}
+int MDBIO_getmd(MDBIO* b, char* buf, size_t size);
 
 size_t MDBIO_feed_file(MDBIO* b, FILE* f, size_t buff_size);
 
+/*
+ * The ways to get the content of a file into the digest.
+ *
+ * MDBIO_IO_READ reads the file through a buffer of buff_size bytes, as
+ * MDBIO_feed_file() does.
+ *
+ * MDBIO_IO_MMAP maps regular files into memory window by window, and feeds
+ * the mappings directly into the digest, without any copy.
+ * Note: truncating a file while it is being mapped raises SIGBUS, so use it
+ * only for files nobody else writes to.
+ *
+ * MDBIO_IO_URING keeps MDBIO_URING_DEPTH reads of buff_size bytes queued
+ * with io_uring, so reading and hashing overlap. MDBIO_IO_URING_DIRECT
+ * does so with O_DIRECT, bypassing the page cache, if the filesystem
+ * supports it.
+ *
+ * Pipes, special files and files reporting no size (e.g. those in procfs),
+ * as well as files on a kernel without io_uring, fall back to
+ * MDBIO_IO_READ with the given buff_size.
+ */
+typedef enum MDBIO_iomode {
+  MDBIO_IO_READ = 0,
+  MDBIO_IO_MMAP,
+  MDBIO_IO_URING,
+  MDBIO_IO_URING_DIRECT,
+} MDBIO_iomode;
+
+#define MDBIO_DEFAULT_BUFF_SIZE ((size_t)1 << 20)
+#define MDBIO_MMAP_WINDOW ((off_t)64 << 20)
+#define MDBIO_URING_DEPTH 4
+#define MDBIO_URING_ALIGN ((size_t)4096)
+
+/*
+ * the feed_file functions return the bytes fed into the digest, or
+ * MDBIO_FEED_FAILED if reading or hashing fails before the end of file, in
+ * which case the digest covers only part of the file, and must not be used.
+ */
+#define MDBIO_FEED_FAILED ((size_t)-1)
+
+bool MDBIO_iomode_byname(const char* name, MDBIO_iomode* mode);
+const char* MDBIO_iomode_name(MDBIO_iomode mode);
+
+size_t MDBIO_feed_file_mmap(MDBIO* b, FILE* f, size_t buff_size);
+size_t MDBIO_feed_file_iomode(MDBIO* b, FILE* f, size_t buff_size,
+			      MDBIO_iomode mode);
+
+/*
+ * A MDSET computes digests of several algorithms over the same data, e.g.
+ * for all active pcr banks of a tpm2, so every file is read only once, and
+ * each buffer read is fanned out to all digest contexts.
+ *
+ * MDSET_getmd() finishes the digest of the ith algorithm (in the order of
+ * mdnames given to MDSET_new()), and resets it for the next file.
+ *
+ * bytes counts all data fed into the MDSET since it was created.
+ *
+ * Digest contexts are reinitialized in place, and files are read into an
+ * arena kept along with the MDSET, which only grows when a larger buffer
+ * is asked for, so hashing files one after another allocates nothing.
+ */
+#define MDSET_MAX 5 //enough for all the banks tpm2.c supports.
+
+typedef struct md_arena {
+  char* buf; // aligned to MDBIO_URING_ALIGN for O_DIRECT.
+  size_t size;
+} md_arena;
+
+typedef struct MDSET {
+  size_t num;
+  uint64_t bytes;
+  const EVP_MD* md[MDSET_MAX];
+  EVP_MD_CTX* ctx[MDSET_MAX];
+  md_arena arena;
+} MDSET;
+
+MDSET* MDSET_new(const char* const* mdnames, size_t num);
+void MDSET_free(MDSET* s);
+size_t MDSET_md_size(const MDSET* s, size_t i);
+int MDSET_update(MDSET* s, const void* data, size_t len);
+// feed data into the ith digest only.
+int MDSET_update_one(MDSET* s, size_t i, const void* data, size_t len);
+size_t MDSET_feed_file(MDSET* s, FILE* f, size_t buff_size,
+		       MDBIO_iomode mode);
+/*
+ * pass everything from fd in to fd out until EOF, and hash it on the way.
+ * when in is a pipe, data is duplicated to out with tee(2) (and splice(2)
+ * from an internal pipe, if out is not a pipe), so only the copy to be
+ * hashed is read; otherwise it is copied through a buffer of buff_size.
+ * returns the bytes passed, or -1 with errno set if in or out fails.
+ */
+ssize_t MDSET_feed_stream(MDSET* s, int in, int out, size_t buff_size);
+int MDSET_getmd(MDSET* s, size_t i, char* buf, size_t size);
+// finish all digests, and store them one after another into buf.
+size_t MDSET_getmds(MDSET* s, char* buf, size_t size);
+/*
+ * MDSET_feed_file() then MDSET_getmds(), but returns 0 if f could not be
+ * read whole, or if the bytes read from a regular file do not add up to
+ * its size, so a partial digest is never taken for the file's.
+ */
+size_t MDSET_digest_file(MDSET* s, FILE* f, size_t buff_size,
+			 MDBIO_iomode mode, char* buf, size_t size);
+
+/*
+ * extend value of size bytes with data in software, as a tpm extends a
+ * pcr: value = H(value || data). returns the size of the new value, or 0
+ * if mdname is unknown, or its digest is not of size bytes.
+ */
+size_t MD_extend(const char* mdname, char* value, size_t size,
+		 const char* data, size_t len);
+
+/*
+ * parse a size such as 4096, 0x1000, 64k, 16m or 1g into size.
+ * returns false if s is malformed, zero, or too large for a size_t.
+ */
+bool MD_parse_size(const char* s, size_t* size);
+
 #ifdef __cplusplus
 #if 0
 {
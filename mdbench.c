@@ -0,0 +1,316 @@
+/* 
+ * mdbench.c
+ * A standalone benchmark of hashing throughput over the MDBIO_* API,
+ * with no TPM involved.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#define _GNU_SOURCE
+#include "md.h"
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#define MAX_ITEMS 16
+
+static const char* usagefmt =
+  "%s [options]\n"
+  "hash files of different sizes on every combination of algorithm,\n"
+  "buffer size and io mode, and print the results as CSV:\n"
+  "alg,io_mode,buffer_size,file_size,seconds,mb_per_s,cycles_per_byte\n"
+  "cycles_per_byte is counted with the TSC, and left empty without one.\n"
+  "options:\n"
+  "-a alg1,alg2... - algorithms, sha1,sha256,sha384,sha512 by default.\n"
+  "-b size1,size2... - buffer sizes, 1k,64k,1m,4m by default.\n"
+  "-s size1,size2... - file sizes, 64k,16m,256m by default.\n"
+  "-m mode1,mode2... - io modes, read,mmap,uring,uring-direct by default.\n"
+  "-r N - run each combination N times and take the fastest, 3 by default.\n"
+  "-d DIR - create the files to hash in DIR, /tmp by default.\n"
+  "-c - drop the files from the page cache before each run, to measure\n"
+  "\tcold reads instead of hashing alone.\n"
+  "sizes could be suffixed with k, m or g.\n";
+
+static size_t split_list(char* s, char** items, size_t max)
+{
+  size_t n = 0;
+  char* save = NULL;
+  char* tok = strtok_r(s, ",", &save);
+  for(; tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    if(n == max)
+      return 0;
+    items[n++] = tok;
+  }
+  return n;
+}
+
+static size_t parse_sizes(char* s, size_t* sizes)
+{
+  char* items[MAX_ITEMS];
+  size_t n = split_list(s, items, MAX_ITEMS);
+  size_t i = 0;
+  for(; i < n; i++) {
+    if(!MD_parse_size(items[i], &sizes[i])) {
+      fprintf(stderr, "Invalid size %s!\n", items[i]);
+      return 0;
+    }
+  }
+  return n;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/*
+ * create a file of size bytes filled with pseudo random data under dir,
+ * and unlink it at once: it is hashed through the fd kept open.
+ */
+static FILE* make_file(const char* dir, size_t size)
+{
+  char path[4096];
+  char* buf = NULL;
+  FILE* f = NULL;
+  int fd = -1;
+  do {
+    snprintf(path, sizeof(path), "%s/mdbench.XXXXXX", dir);
+    fd = mkstemp(path);
+    if(fd < 0)
+      break;
+    unlink(path);
+    buf = (char*)malloc(MDBIO_DEFAULT_BUFF_SIZE);
+    if(buf == NULL)
+      break;
+    uint64_t x = 0x9e3779b97f4a7c15ULL ^ size;
+    size_t done = 0;
+    while(done < size) {
+      size_t len = size - done;
+      size_t i = 0;
+      if(len > MDBIO_DEFAULT_BUFF_SIZE)
+	len = MDBIO_DEFAULT_BUFF_SIZE;
+      for(; i + sizeof(x) <= len; i += sizeof(x)) {
+	x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+	memcpy(buf + i, &x, sizeof(x));
+      }
+      memset(buf + i, 0, len - i);
+      if(write(fd, buf, len) != (ssize_t)len)
+	break;
+      done += len;
+    }
+    if(done != size || fsync(fd) != 0)
+      break;
+    f = fdopen(fd, "rb");
+  } while(0);
+  if(f == NULL && fd >= 0)
+    close(fd);
+  free(buf);
+  return f;
+}
+
+/*
+ * hash f once from its beginning, return seconds taken, or a negative
+ * value on error.
+ */
+static double run_once(MDBIO* b, FILE* f, size_t file_size,
+		       size_t buff_size, MDBIO_iomode mode, bool cold,
+		       uint64_t* cyc)
+{
+  char md[EVP_MAX_MD_SIZE];
+  rewind(f);
+  if(cold)
+    posix_fadvise(fileno(f), 0, 0, POSIX_FADV_DONTNEED);
+
+  uint64_t c = cycles();
+  double start = now();
+  size_t len = MDBIO_feed_file_iomode(b, f, buff_size, mode);
+  int mdlen = MDBIO_getmd(b, md, sizeof(md));
+  double secs = now() - start;
+  *cyc = cycles() - c;
+
+  if(len != file_size || mdlen <= 0)
+    return -1;
+  return secs;
+}
+
+int main(int argc, char** argv)
+{
+  char defalgs[] = "sha1,sha256,sha384,sha512";
+  char defbuffs[] = "1k,64k,1m,4m";
+  char deffiles[] = "64k,16m,256m";
+  char defmodes[] = "read,mmap,uring,uring-direct";
+  char* alglist = defalgs;
+  char* bufflist = defbuffs;
+  char* filelist = deffiles;
+  char* modelist = defmodes;
+  const char* dir = "/tmp";
+  unsigned long repeat = 3;
+  bool cold = false;
+  int opt;
+
+  while((opt = getopt(argc, argv, "a:b:s:m:r:d:ch")) != -1) {
+    switch(opt) {
+    case 'a':
+      alglist = optarg;
+      break;
+    case 'b':
+      bufflist = optarg;
+      break;
+    case 's':
+      filelist = optarg;
+      break;
+    case 'm':
+      modelist = optarg;
+      break;
+    case 'r':
+      repeat = strtoul(optarg, NULL, 10);
+      if(repeat == 0) {
+	fprintf(stderr, "Invalid repeat count %s!\n", optarg);
+	return -(EXIT_FAILURE);
+      }
+      break;
+    case 'd':
+      dir = optarg;
+      break;
+    case 'c':
+      cold = true;
+      break;
+    default:
+      fprintf(stderr, usagefmt, argv[0]);
+      return (opt == 'h')? 0: -(EXIT_FAILURE);
+    }
+  }
+
+  char* algs[MAX_ITEMS];
+  char* modenames[MAX_ITEMS];
+  MDBIO_iomode modes[MAX_ITEMS];
+  size_t buffs[MAX_ITEMS];
+  size_t files[MAX_ITEMS];
+  size_t nalg = split_list(alglist, algs, MAX_ITEMS);
+  size_t nbuff = parse_sizes(bufflist, buffs);
+  size_t nfile = parse_sizes(filelist, files);
+  size_t nmode = split_list(modelist, modenames, MAX_ITEMS);
+  if(nalg == 0 || nbuff == 0 || nfile == 0 || nmode == 0) {
+    fprintf(stderr, usagefmt, argv[0]);
+    return -(EXIT_FAILURE);
+  }
+  {
+    size_t i = 0;
+    for(; i < nmode; i++) {
+      if(!MDBIO_iomode_byname(modenames[i], &modes[i])) {
+	fprintf(stderr, "Unknown io mode %s!\n", modenames[i]);
+	return -(EXIT_FAILURE);
+      }
+    }
+  }
+
+  if(!OSSL_init()) {
+    fputs("Unable to init openssl!\n", stderr);
+    return -(EXIT_FAILURE);
+  }
+
+  int ret = 0;
+  size_t fi = 0;
+  puts("alg,io_mode,buffer_size,file_size,seconds,mb_per_s,cycles_per_byte");
+  for(; fi < nfile && ret == 0; fi++) {
+    FILE* f = make_file(dir, files[fi]);
+    if(f == NULL) {
+      fprintf(stderr, "Unable to create a file of %zu bytes in %s: %s\n",
+	      files[fi], dir, strerror(errno));
+      ret = -(EXIT_FAILURE);
+      break;
+    }
+    size_t ai = 0;
+    for(; ai < nalg && ret == 0; ai++) {
+      // one MDBIO serves all runs, as it does for files in pcrtool.
+      MDBIO* b = MDBIO_new(algs[ai]);
+      if(b == NULL) {
+	fprintf(stderr, "Unknown algorithm %s!\n", algs[ai]);
+	ret = -(EXIT_FAILURE);
+	break;
+      }
+      size_t mi = 0;
+      for(; mi < nmode && ret == 0; mi++) {
+	size_t bi = 0;
+	for(; bi < nbuff && ret == 0; bi++) {
+	  double best = -1;
+	  uint64_t bestcyc = 0;
+	  unsigned long r = 0;
+	  for(; r < repeat; r++) {
+	    uint64_t cyc = 0;
+	    double secs = run_once(b, f, files[fi], buffs[bi],
+				   modes[mi], cold, &cyc);
+	    if(secs < 0) {
+	      fprintf(stderr, "Unable to hash with %s on %s!\n",
+		      algs[ai], modenames[mi]);
+	      ret = -(EXIT_FAILURE);
+	      break;
+	    }
+	    if(best < 0 || secs < best) {
+	      best = secs;
+	      bestcyc = cyc;
+	    }
+	  }
+	  if(ret != 0)
+	    break;
+	  printf("%s,%s,%zu,%zu,%.6f,%.1f,", algs[ai],
+		 MDBIO_iomode_name(modes[mi]), buffs[bi], files[fi], best,
+		 (best > 0)? files[fi] / best / 1e6: 0.0);
+#ifdef HAVE_TSC
+	  printf("%.2f", (double)bestcyc / files[fi]);
+#endif
+	  putchar('\n');
+	  fflush(stdout);
+	}
+      }
+      MDBIO_free(b);
+    }
+    fclose(f);
+  }
+
+  OSSL_uninit();
+  return ret;
+}
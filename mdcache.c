@@ -0,0 +1,303 @@
+/* 
+ * mdcache.c
+ * persistent cache of digests of files, keyed by inode metadata.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "mdcache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MDCACHE_MAGIC "PCRMDC1"
+#define MDCACHE_PROBES 16
+
+typedef struct mdcache_key {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  uint64_t mtime_ns;
+  uint64_t ctime_ns;
+  uint32_t nid; //NID of the digest algorithm.
+  uint32_t pad;
+} mdcache_key;
+
+typedef struct mdcache_slot {
+  mdcache_key key;
+  uint8_t used;
+  uint8_t mdsize;
+  uint8_t pad[6];
+  char md[EVP_MAX_MD_SIZE];
+  uint64_t check; //to ignore slots torn by a crash.
+} mdcache_slot;
+
+typedef struct mdcache_header {
+  char magic[8];
+  uint32_t slot_size;
+  uint32_t nslots;
+} mdcache_header;
+
+struct mdcache {
+  int fd;
+  size_t maplen;
+  mdcache_header* hdr;
+  mdcache_slot* slots;
+  unsigned int verify_percent;
+  unsigned int seed;
+  pthread_mutex_t lock;
+
+  size_t hits;
+  size_t misses;
+  size_t verified;
+  size_t mismatches;
+  uint64_t bytes_saved;
+};
+
+static uint64_t fnv1a(const void* p, size_t len)
+{
+  const unsigned char* c = (const unsigned char*)p;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for(; len > 0; len--, c++) {
+    h ^= *c;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static uint64_t slot_check(const mdcache_slot* slot)
+{
+  return fnv1a(slot, offsetof(mdcache_slot, check));
+}
+
+static bool key_equal(const mdcache_key* a, const mdcache_key* b)
+{
+  return (a->dev == b->dev
+	  && a->ino == b->ino
+	  && a->size == b->size
+	  && a->mtime_ns == b->mtime_ns
+	  && a->ctime_ns == b->ctime_ns
+	  && a->nid == b->nid);
+}
+
+mdcache* mdcache_open(const char* path, uint32_t nslots,
+		      unsigned int verify_percent)
+{
+  mdcache* c = (mdcache*)calloc(1, sizeof(mdcache));
+  if(c == NULL)
+    return NULL;
+
+  // keep the table a power of 2, so slots could be picked with a mask.
+  while(nslots & (nslots - 1))
+    nslots &= nslots - 1;
+  if(nslots < MDCACHE_PROBES)
+    nslots = MDCACHE_PROBES;
+
+  c->verify_percent = verify_percent;
+  c->seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+  c->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if(c->fd < 0) {
+    free(c);
+    return NULL;// please check errno.
+  }
+
+  do {
+    struct stat st;
+    mdcache_header hdr;
+    // another pcrtool running may be writing the cache.
+    if(flock(c->fd, LOCK_EX) != 0 || fstat(c->fd, &st) != 0)
+      break;
+
+    if(st.st_size >= (off_t)sizeof(hdr)
+       && pread(c->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr)
+       && memcmp(hdr.magic, MDCACHE_MAGIC, sizeof(hdr.magic)) == 0
+       && hdr.slot_size == sizeof(mdcache_slot)
+       && hdr.nslots != 0
+       && (hdr.nslots & (hdr.nslots - 1)) == 0
+       && st.st_size == (off_t)(sizeof(hdr)
+				+ (size_t)hdr.nslots * sizeof(mdcache_slot))) {
+      nslots = hdr.nslots;
+    } else {
+      // a new or a broken cache, (re)build it.
+      memset(&hdr, 0, sizeof(hdr));
+      memcpy(hdr.magic, MDCACHE_MAGIC, sizeof(hdr.magic));
+      hdr.slot_size = sizeof(mdcache_slot);
+      hdr.nslots = nslots;
+      if(ftruncate(c->fd, 0) != 0
+	 || ftruncate(c->fd, sizeof(hdr) + (size_t)nslots * sizeof(mdcache_slot)) != 0
+	 || pwrite(c->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+	break;
+    }
+
+    c->maplen = sizeof(hdr) + (size_t)nslots * sizeof(mdcache_slot);
+    void* p = mmap(NULL, c->maplen, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+    if(p == MAP_FAILED)
+      break;
+    c->hdr = (mdcache_header*)p;
+    c->slots = (mdcache_slot*)(c->hdr + 1);
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+  } while(0);
+
+  close(c->fd);
+  free(c);
+  return NULL;
+}
+
+void mdcache_close(mdcache* c)
+{
+  if(c == NULL)
+    return;
+  munmap(c->hdr, c->maplen);
+  close(c->fd); //the lock is released as well.
+  pthread_mutex_destroy(&c->lock);
+  free(c);
+}
+
+static mdcache_slot* mdcache_find(mdcache* c, const mdcache_key* key,
+				  bool for_insert)
+{
+  uint32_t mask = c->hdr->nslots - 1;
+  uint64_t h = fnv1a(key, sizeof(*key));
+  mdcache_slot* victim = &c->slots[h & mask];
+  size_t i = 0;
+  for(; i < MDCACHE_PROBES; i++) {
+    mdcache_slot* slot = &c->slots[(h + i) & mask];
+    if(!slot->used || slot->check != slot_check(slot)) {
+      if(for_insert)
+	return slot;
+      continue;
+    }
+    if(key_equal(&slot->key, key))
+      return slot;
+  }
+  // all probed slots are taken, evict the first one.
+  return for_insert? victim: NULL;
+}
+
+size_t mdcache_digest_file(mdcache* c, MDSET* s, FILE* f,
+			   size_t buff_size, MDBIO_iomode mode,
+			   char* buf, size_t size)
+{
+  struct stat st;
+  mdcache_key key[MDSET_MAX];
+  char cached[MDSET_MAX * EVP_MAX_MD_SIZE];
+  size_t total = 0;
+  bool cacheable = (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode));
+  bool hit = cacheable;
+  bool verify = false;
+
+  memset(key, 0, sizeof(key));
+  pthread_mutex_lock(&c->lock);
+  {
+    size_t k = 0;
+    for(; k < s->num && cacheable; k++) {
+      key[k].dev = st.st_dev;
+      key[k].ino = st.st_ino;
+      key[k].size = st.st_size;
+      key[k].mtime_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+      key[k].ctime_ns = st.st_ctim.tv_sec * 1000000000ULL + st.st_ctim.tv_nsec;
+      key[k].nid = EVP_MD_type(s->md[k]);
+
+      mdcache_slot* slot = mdcache_find(c, &key[k], false);
+      if(slot == NULL || slot->mdsize != MDSET_md_size(s, k)) {
+	hit = false;
+	continue;
+      }
+      memcpy(cached + total, slot->md, slot->mdsize);
+      total += slot->mdsize;
+    }
+  }
+  if(hit)
+    verify = (c->verify_percent > 0
+	      && (unsigned int)(rand_r(&c->seed) % 100) < c->verify_percent);
+  if(hit && !verify) {
+    c->hits ++;
+    c->bytes_saved += st.st_size;
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  if(hit && !verify) {
+    if(size < total)
+      return 0;
+    memcpy(buf, cached, total);
+    return total;
+  }
+
+  total = MDSET_digest_file(s, f, buff_size, mode, buf, size);
+  if(total == 0)
+    return 0;
+
+  pthread_mutex_lock(&c->lock);
+  if(verify) {
+    c->verified ++;
+    if(0 != memcmp(cached, buf, total)) {
+      c->mismatches ++;
+      fprintf(stderr,
+	      "Warning: cached digest of inode %llu mismatches its content!\n",
+	      (unsigned long long)st.st_ino);
+    }
+  } else {
+    c->misses ++;
+  }
+  if(cacheable) {
+    size_t k = 0;
+    const char* md = buf;
+    for(; k < s->num; md += MDSET_md_size(s, k), k++) {
+      mdcache_slot* slot = mdcache_find(c, &key[k], true);
+      slot->used = 0;
+      slot->key = key[k];
+      slot->mdsize = MDSET_md_size(s, k);
+      memcpy(slot->md, md, slot->mdsize);
+      slot->used = 1;
+      slot->check = slot_check(slot);
+    }
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  return total;
+}
+
+void mdcache_report(const mdcache* c, FILE* fp)
+{
+  fprintf(fp,
+	  "digest cache: %zu hit(s), %zu miss(es), "
+	  "%zu hit(s) verified with %zu mismatch(es), "
+	  "%llu byte(s) not read.\n",
+	  c->hits, c->misses, c->verified, c->mismatches,
+	  (unsigned long long)c->bytes_saved);
+}
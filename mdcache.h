@@ -0,0 +1,88 @@
+/* 
+ * mdcache.h
+ * persistent cache of digests of files, keyed by inode metadata.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _MDCACHE_H_
+#define _MDCACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include "md.h"
+#include <stdint.h>
+
+/*
+ * A mdcache maps (st_dev, st_ino, size, mtime, ctime, algorithm) of a
+ * regular file to its digest, so unchanged files need not be read again.
+ * It is stored as an open-addressing hash table in a file, which is
+ * mapped into memory and locked exclusively while opened.
+ *
+ * NOTE: a hit trusts the metadata of the file rather than its content.
+ * ctime could not be set from userspace, but anyone able to modify a file
+ * and to change the clock could make the cache lie. That is why the cache
+ * is opt-in, and could verify a random sample of hits by reading the file
+ * anyway (verify_percent).
+ */
+
+typedef struct mdcache mdcache;
+
+#define MDCACHE_DEFAULT_SLOTS ((uint32_t)1 << 16)
+
+mdcache* mdcache_open(const char* path, uint32_t nslots,
+		      unsigned int verify_percent);
+void mdcache_close(mdcache* c);
+
+/*
+ * Digest a file on all algorithms of s, as MDSET_feed_file() followed by
+ * MDSET_getmds() do, but take the digests from the cache on a hit.
+ * returns the total size of digests stored into buf, or 0 on failure.
+ */
+size_t mdcache_digest_file(mdcache* c, MDSET* s, FILE* f,
+			   size_t buff_size, MDBIO_iomode mode,
+			   char* buf, size_t size);
+
+// print a hit/miss summary.
+void mdcache_report(const mdcache* c, FILE* fp);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
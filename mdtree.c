@@ -0,0 +1,381 @@
+/* 
+ * mdtree.c
+ * parallel walk of a directory tree in a deterministic order,
+ * and the manifest of digests of its files.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#define _GNU_SOURCE // for getdents64()
+#include "mdtree.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MDTREE_DENTS_SIZE ((size_t)64 << 10)
+
+typedef struct strvec {
+  size_t num;
+  size_t cap;
+  char** v;
+} strvec;
+
+static bool strvec_push(strvec* a, char* s)
+{
+  if(a->num == a->cap) {
+    size_t cap = a->cap? a->cap * 2: 256;
+    char** v = (char**)realloc(a->v, cap * sizeof(char*));
+    if(v == NULL)
+      return false;
+    a->v = v;
+    a->cap = cap;
+  }
+  a->v[a->num++] = s;
+  return true;
+}
+
+static void strvec_clear(strvec* a)
+{
+  size_t i = 0;
+  for(; i < a->num; i++)
+    free(a->v[i]);
+  free(a->v);
+  memset(a, 0, sizeof(*a));
+}
+
+/*
+ * directories found but not yet read are shared by all walkers on a stack,
+ * while files found are kept by each walker, and merged after all of them
+ * finish.
+ */
+typedef struct mdtree_walker mdtree_walker;
+
+typedef struct mdtree_walk_state {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int rootfd;
+  strvec pending;
+  size_t active;
+  bool failed;
+} mdtree_walk_state;
+
+struct mdtree_walker {
+  mdtree_walk_state* w;
+  pthread_t th;
+  strvec files;
+  size_t skipped;
+  size_t dirs;
+};
+
+static char* join_path(const char* dir, const char* name)
+{
+  size_t dl = strlen(dir);
+  size_t nl = strlen(name);
+  char* p = (char*)malloc(dl + nl + 2);
+  if(p == NULL)
+    return NULL;
+  if(dl == 0) {
+    memcpy(p, name, nl + 1);
+  } else {
+    memcpy(p, dir, dl);
+    p[dl] = '/';
+    memcpy(p + dl + 1, name, nl + 1);
+  }
+  return p;
+}
+
+static bool mdtree_read_dir(mdtree_walker* wk, const char* dir,
+			    char* dents, strvec* subdirs)
+{
+  int fd = openat(wk->w->rootfd, (dir[0] == '\0')? ".": dir,
+		  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if(fd < 0) {
+    fprintf(stderr, "Unable to open directory %s: %s\n", dir, strerror(errno));
+    return false;
+  }
+
+  bool ok = true;
+  for(;;) {
+    ssize_t n = getdents64(fd, dents, MDTREE_DENTS_SIZE);
+    if(n == 0)
+      break;
+    if(n < 0) {
+      fprintf(stderr, "Unable to read directory %s: %s\n", dir, strerror(errno));
+      ok = false;
+      break;
+    }
+
+    ssize_t off = 0;
+    while(off < n && ok) {
+      struct dirent64* d = (struct dirent64*)(dents + off);
+      unsigned char type = d->d_type;
+      off += d->d_reclen;
+
+      if(0 == strcmp(d->d_name, ".") || 0 == strcmp(d->d_name, ".."))
+	continue;
+      if(type == DT_UNKNOWN) { // some filesystems do not fill d_type.
+	struct stat st;
+	if(fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+	  ok = false;
+	  break;
+	}
+	type = S_ISDIR(st.st_mode)? DT_DIR: S_ISREG(st.st_mode)? DT_REG: DT_LNK;
+      }
+      if(type != DT_DIR && type != DT_REG) {
+	wk->skipped ++;
+	continue;
+      }
+
+      char* p = join_path(dir, d->d_name);
+      if(p == NULL
+	 || !strvec_push((type == DT_DIR)? subdirs: &wk->files, p)) {
+	free(p);
+	ok = false;
+      }
+    }
+    if(!ok)
+      break;
+  }
+  close(fd);
+  wk->dirs ++;
+  return ok;
+}
+
+static void* mdtree_walker_run(void* arg)
+{
+  mdtree_walker* wk = (mdtree_walker*)arg;
+  mdtree_walk_state* w = wk->w;
+  char* dents = (char*)malloc(MDTREE_DENTS_SIZE);
+  strvec subdirs = {0, 0, NULL};
+
+  pthread_mutex_lock(&w->lock);
+  if(dents == NULL)
+    w->failed = true;
+  for(;;) {
+    while(!w->failed && w->pending.num == 0 && w->active > 0)
+      pthread_cond_wait(&w->cond, &w->lock);
+    if(w->failed || w->pending.num == 0)
+      break; // nothing left and nobody could find more.
+
+    char* dir = w->pending.v[-- w->pending.num];
+    w->active ++;
+    pthread_mutex_unlock(&w->lock);
+
+    bool ok = mdtree_read_dir(wk, dir, dents, &subdirs);
+    free(dir);
+
+    pthread_mutex_lock(&w->lock);
+    w->active --;
+    if(!ok)
+      w->failed = true;
+    while(subdirs.num > 0 && ok) {
+      if(!strvec_push(&w->pending, subdirs.v[subdirs.num - 1])) {
+	w->failed = true;
+	break;
+      }
+      subdirs.num --;
+    }
+    pthread_cond_broadcast(&w->cond);
+  }
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+
+  strvec_clear(&subdirs);
+  free(dents);
+  return NULL;
+}
+
+static int cmp_path(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+mdtree* mdtree_walk(const char* root, size_t workers)
+{
+  mdtree_walk_state w;
+  mdtree* t = (mdtree*)calloc(1, sizeof(mdtree));
+  if(t == NULL)
+    return NULL;
+  if(workers == 0)
+    workers = 1;
+
+  memset(&w, 0, sizeof(w));
+  w.rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(w.rootfd < 0) {
+    fprintf(stderr, "Unable to open directory %s: %s\n", root, strerror(errno));
+    free(t);
+    return NULL;
+  }
+  t->rootfd = w.rootfd;
+  pthread_mutex_init(&w.lock, NULL);
+  pthread_cond_init(&w.cond, NULL);
+
+  mdtree_walker wk[workers];
+  memset(wk, 0, sizeof(wk));
+  char* top = strdup("");
+  if(top == NULL || !strvec_push(&w.pending, top)) {
+    free(top);
+    w.failed = true;
+  }
+
+  {
+    size_t i = 0;
+    size_t started = 0;
+    for(; i < workers; i++)
+      wk[i].w = &w;
+    // with one walker, walk in this thread.
+    for(i = 1; i < workers; i++) {
+      if(0 != pthread_create(&wk[i].th, NULL, mdtree_walker_run, &wk[i]))
+	break;
+      started ++;
+    }
+    mdtree_walker_run(&wk[0]);
+    for(i = 1; i <= started; i++)
+      pthread_join(wk[i].th, NULL);
+  }
+
+  strvec all = {0, 0, NULL};
+  {
+    size_t i = 0;
+    for(; i < workers; i++) {
+      size_t j = 0;
+      for(; j < wk[i].files.num && !w.failed; j++) {
+	if(!strvec_push(&all, wk[i].files.v[j]))
+	  w.failed = true;
+	else
+	  wk[i].files.v[j] = NULL;
+      }
+      t->skipped += wk[i].skipped;
+      t->dirs += wk[i].dirs;
+      strvec_clear(&wk[i].files);
+    }
+  }
+  strvec_clear(&w.pending);
+  pthread_cond_destroy(&w.cond);
+  pthread_mutex_destroy(&w.lock);
+
+  t->num = all.num;
+  t->paths = all.v;
+  if(w.failed) {
+    mdtree_free(t);
+    return NULL;
+  }
+  qsort(t->paths, t->num, sizeof(char*), cmp_path);
+  return t;
+}
+
+void mdtree_free(mdtree* t)
+{
+  if(t == NULL)
+    return;
+  {
+    size_t i = 0;
+    for(; i < t->num; i++)
+      free(t->paths[i]);
+  }
+  free(t->paths);
+  close(t->rootfd);
+  free(t);
+}
+
+FILE* mdtree_open(const mdtree* t, size_t index)
+{
+  int fd = openat(t->rootfd, t->paths[index],
+		  O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if(fd < 0)
+    return NULL;
+  FILE* f = fdopen(fd, "rb");
+  if(f == NULL)
+    close(fd);
+  return f;
+}
+
+/*
+ * format a line of the manifest into buf, which should hold at least
+ * 2 * (mdsize + strlen(path)) + 4 bytes.
+ */
+static size_t mdtree_format_line(char* buf, const char* path,
+				 const char* md, size_t mdsize)
+{
+  static const char hex[] = "0123456789abcdef";
+  bool escaped = (strpbrk(path, "\\\n") != NULL);
+  size_t n = 0;
+  size_t i = 0;
+
+  if(escaped)
+    buf[n++] = '\\';
+  for(; i < mdsize; i++) {
+    buf[n++] = hex[(unsigned char)md[i] >> 4];
+    buf[n++] = hex[(unsigned char)md[i] & 0xf];
+  }
+  buf[n++] = ' ';
+  buf[n++] = ' ';
+  for(; *path != '\0'; path++) {
+    if(*path == '\\') {
+      buf[n++] = '\\';
+      buf[n++] = '\\';
+    } else if(*path == '\n') {
+      buf[n++] = '\\';
+      buf[n++] = 'n';
+    } else {
+      buf[n++] = *path;
+    }
+  }
+  buf[n++] = '\n';
+  return n;
+}
+
+bool mdtree_manifest_add(MDSET* s, size_t i, const char* path,
+			 const char* md, size_t mdsize)
+{
+  char* buf = (char*)malloc(2 * (mdsize + strlen(path)) + 4);
+  if(buf == NULL)
+    return false;
+  size_t n = mdtree_format_line(buf, path, md, mdsize);
+  bool ok = MDSET_update_one(s, i, buf, n);
+  free(buf);
+  return ok;
+}
+
+int mdtree_fprint_line(FILE* fp, const char* path,
+		       const char* md, size_t mdsize)
+{
+  char* buf = (char*)malloc(2 * (mdsize + strlen(path)) + 4);
+  if(buf == NULL)
+    return -1;
+  size_t n = mdtree_format_line(buf, path, md, mdsize);
+  int ret = (fwrite(buf, 1, n, fp) == n)? (int)n: -1;
+  free(buf);
+  return ret;
+}
@@ -0,0 +1,94 @@
+/* 
+ * mdtree.h
+ * parallel walk of a directory tree in a deterministic order,
+ * and the manifest of digests of its files.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _MDTREE_H_
+#define _MDTREE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include "md.h"
+
+/*
+ * mdtree_walk() lists all regular files under root with up to workers
+ * threads, reading directories with openat() and getdents64(), and sorts
+ * their paths (relative to root) bytewise, so the result does not depend
+ * on the order the filesystem returns entries, nor on the order threads
+ * finish. Symbolic links are not followed, and like other special files
+ * they are only counted as skipped. No file is opened during the walk;
+ * mdtree_open() opens one when it is to be hashed.
+ *
+ * The manifest of a tree has one line per file, in the sorted order, in
+ * the format of sha256sum and friends:
+ *
+ *     <hex digest>  <path>\n
+ *
+ * with '\\' and '\n' in path escaped as they do, so its digest could be
+ * reproduced with e.g.
+ *
+ *     cd root && find . -type f | cut -c3- | LC_ALL=C sort | xargs sha256sum
+ */
+
+typedef struct mdtree {
+  int rootfd;
+  size_t num;
+  char** paths;
+  size_t skipped;
+  size_t dirs;
+} mdtree;
+
+mdtree* mdtree_walk(const char* root, size_t workers);
+void mdtree_free(mdtree* t);
+
+FILE* mdtree_open(const mdtree* t, size_t index);
+
+// feed the manifest line of a file into the ith digest of s.
+bool mdtree_manifest_add(MDSET* s, size_t i, const char* path,
+			 const char* md, size_t mdsize);
+int mdtree_fprint_line(FILE* fp, const char* path,
+		       const char* md, size_t mdsize);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
@@ -0,0 +1,334 @@
+/* 
+ * merkle.c
+ * parallel merkle tree measurement of files and block devices,
+ * compatible with the file digest of fs-verity.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "merkle.h"
+#include "workq.h"
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <linux/fsverity.h>
+
+/*
+ * struct fsverity_descriptor of the kernel, all integers in little endian.
+ */
+typedef struct merkle_descriptor {
+  uint8_t version;
+  uint8_t hash_algorithm;
+  uint8_t log_blocksize;
+  uint8_t salt_size;
+  uint32_t sig_size;
+  uint64_t data_size;
+  uint8_t root_hash[64];
+  uint8_t salt[32];
+  uint8_t reserved[144];
+} merkle_descriptor;
+
+typedef struct merkle_job {
+  const merkle_params* p;
+  const EVP_MD* md;
+  EVP_MD_CTX* salted; //holds the padded salt, copied for every block.
+  int fd;
+  uint64_t data_size;
+  size_t hpb; //hashes per block.
+  size_t dsize;
+  EVP_MD_CTX** ctx; //one per worker.
+  unsigned char** buff; //one per worker.
+  unsigned char* hashes; //hash of every level-0 hash block.
+} merkle_job;
+
+// a multiple of every block size merkle_params_check() takes.
+#define MERKLE_READ_SIZE ((size_t)1 << 20)
+
+uint8_t merkle_alg_id(const char* mdname)
+{
+  if(0 == strcmp(mdname, "sha256"))
+    return FS_VERITY_HASH_ALG_SHA256;
+  if(0 == strcmp(mdname, "sha512"))
+    return FS_VERITY_HASH_ALG_SHA512;
+  return 0;
+}
+
+bool merkle_params_check(const merkle_params* p)
+{
+  return (merkle_alg_id(p->mdname) != 0
+	  && p->block_size >= 1024
+	  && p->block_size <= 65536
+	  && (p->block_size & (p->block_size - 1)) == 0
+	  && p->salt_size <= MERKLE_MAX_SALT_SIZE);
+}
+
+static bool merkle_hash_block(const merkle_job* j, EVP_MD_CTX* ctx,
+			      const void* block, unsigned char* out)
+{
+  unsigned int len = 0;
+  if(j->salted) {
+    if(!EVP_MD_CTX_copy_ex(ctx, j->salted))
+      return false;
+  } else if(!EVP_DigestInit_ex(ctx, j->md, NULL)) {
+    return false;
+  }
+  return (EVP_DigestUpdate(ctx, block, j->p->block_size)
+	  && EVP_DigestFinal_ex(ctx, out, &len));
+}
+
+/*
+ * Each job covers the data blocks hashed into one level-0 hash block, and
+ * stores the hash of that hash block, so only 1/hpb of level 0 is kept.
+ * Data blocks are read MERKLE_READ_SIZE bytes at a time, rather than all
+ * hpb of them (e.g. 128M with 64k blocks of sha256), into every worker.
+ */
+static FP_workq_job(merkle_job_run)
+{
+  merkle_job* j = (merkle_job*)arg;
+  size_t bs = j->p->block_size;
+  size_t rs = MERKLE_READ_SIZE;
+  unsigned char* data = j->buff[worker];
+  unsigned char* level0 = data + rs;
+  uint64_t off = (uint64_t)index * bs * j->hpb;
+  uint64_t len = j->data_size - off;
+  if(len > bs * j->hpb)
+    len = bs * j->hpb;
+
+  memset(level0, 0, bs);
+  uint64_t done = 0;
+  while(done < len) {
+    size_t n = (len - done < rs)? (size_t)(len - done): rs;
+    size_t got = 0;
+    while(got < n) {
+      ssize_t r = pread(j->fd, data + got, n - got, off + done + got);
+      if(r < 0 && errno == EINTR)
+	continue;
+      if(r <= 0)
+	return -(EXIT_FAILURE); // the file shrank, or an I/O error.
+      got += r;
+    }
+    // zero-pad the last data block.
+    memset(data + n, 0, (bs - n % bs) % bs);
+
+    size_t i = 0;
+    for(; i * bs < n; i++) {
+      if(!merkle_hash_block(j, j->ctx[worker], data + i * bs,
+			    level0 + (done / bs + i) * j->dsize))
+	return -(EXIT_FAILURE);
+    }
+    done += n;
+  }
+  if(j->data_size <= bs) {
+    // a single data block has no tree, its hash is the root hash.
+    memcpy(j->hashes, level0, j->dsize);
+    return 0;
+  }
+  if(!merkle_hash_block(j, j->ctx[worker], level0,
+			j->hashes + index * j->dsize))
+    return -(EXIT_FAILURE);
+  return 0;
+}
+
+static bool merkle_data_size(int fd, uint64_t* size)
+{
+  struct stat st;
+  if(fstat(fd, &st) != 0)
+    return false;
+  if(S_ISREG(st.st_mode)) {
+    *size = st.st_size;
+    return true;
+  }
+  if(S_ISBLK(st.st_mode))
+    return ioctl(fd, BLKGETSIZE64, size) == 0;
+  errno = EINVAL; // pipes could not be read at random offsets.
+  return false;
+}
+
+size_t merkle_digest_file(const merkle_params* p, FILE* f, size_t workers,
+			  char* buf, size_t size, merkle_info* info)
+{
+  merkle_job j;
+  memset(&j, 0, sizeof(j));
+  memset(info, 0, sizeof(*info));
+  j.p = p;
+  j.fd = fileno(f);
+  j.md = EVP_get_digestbyname(p->mdname);
+  info->hash_algorithm = merkle_alg_id(p->mdname);
+  if(j.md == NULL || info->hash_algorithm == 0
+     || size < (size_t)EVP_MD_size(j.md)
+     || !merkle_data_size(j.fd, &j.data_size))
+    return 0;
+  j.dsize = EVP_MD_size(j.md);
+  j.hpb = p->block_size / j.dsize;
+  info->data_size = j.data_size;
+  info->root_size = j.dsize;
+
+  size_t nunits = (j.data_size + p->block_size * j.hpb - 1)
+    / (p->block_size * j.hpb);
+  if(workers == 0)
+    workers = 1;
+  if(workers > nunits && nunits > 0)
+    workers = nunits;
+
+  EVP_MD_CTX* ctx[workers];
+  unsigned char* buff[workers];
+  memset(ctx, 0, sizeof(ctx));
+  memset(buff, 0, sizeof(buff));
+  j.ctx = ctx;
+  j.buff = buff;
+
+  size_t ret = 0;
+  do {
+    if(p->salt_size > 0) {
+      // the salt is padded to the block size of the hash function.
+      unsigned char padded[EVP_MAX_MD_SIZE * 2];
+      size_t padsize = EVP_MD_block_size(j.md);
+      padsize = (p->salt_size + padsize - 1) / padsize * padsize;
+      memset(padded, 0, sizeof(padded));
+      memcpy(padded, p->salt, p->salt_size);
+      j.salted = EVP_MD_CTX_new();
+      if(j.salted == NULL
+	 || !EVP_DigestInit_ex(j.salted, j.md, NULL)
+	 || !EVP_DigestUpdate(j.salted, padded, padsize))
+	break;
+    }
+
+    if(nunits > 0) {
+      j.hashes = (unsigned char*)malloc(nunits * j.dsize);
+      if(j.hashes == NULL)
+	break;
+      size_t i = 0;
+      for(; i < workers; i++) {
+	ctx[i] = EVP_MD_CTX_new();
+	buff[i] = (unsigned char*)malloc(MERKLE_READ_SIZE + p->block_size);
+	if(ctx[i] == NULL || buff[i] == NULL)
+	  break;
+      }
+      if(i < workers)
+	break;
+
+      workq* q = workq_new(workers, nunits, merkle_job_run, &j);
+      if(q == NULL)
+	break;
+      for(i = 0; i < nunits; i++) {
+	if(workq_wait(q, i) != 0)
+	  break;
+      }
+      workq_free(q);
+      if(i < nunits)
+	break;
+
+      // upper levels are 1/hpb the size of level 0, hash them in place.
+      size_t n = nunits;
+      info->levels = (j.data_size > p->block_size)? 1: 0;
+      while(n > 1) {
+	unsigned char* block = buff[0];
+	size_t next = (n + j.hpb - 1) / j.hpb;
+	for(i = 0; i < next; i++) {
+	  size_t cnt = (n - i * j.hpb < j.hpb)? n - i * j.hpb: j.hpb;
+	  memset(block, 0, p->block_size);
+	  memcpy(block, j.hashes + i * j.hpb * j.dsize, cnt * j.dsize);
+	  if(!merkle_hash_block(&j, ctx[0], block, j.hashes + i * j.dsize))
+	    break;
+	}
+	if(i < next)
+	  break;
+	n = next;
+	info->levels ++;
+      }
+      if(n > 1)
+	break;
+      memcpy(info->root_hash, j.hashes, j.dsize);
+    } // an empty file has a root hash of all zeros, and no tree at all.
+
+    merkle_descriptor desc;
+    unsigned int len = 0;
+    memset(&desc, 0, sizeof(desc));
+    desc.version = 1;
+    desc.hash_algorithm = info->hash_algorithm;
+    desc.log_blocksize = __builtin_ctzl(p->block_size);
+    desc.salt_size = p->salt_size;
+    desc.data_size = htole64(j.data_size);
+    memcpy(desc.root_hash, info->root_hash, j.dsize);
+    memcpy(desc.salt, p->salt, p->salt_size);
+    if(!EVP_Digest(&desc, sizeof(desc), (unsigned char*)buf, &len, j.md, NULL))
+      break;
+    ret = len;
+  } while(0);
+
+  {
+    size_t i = 0;
+    for(; i < workers; i++) {
+      EVP_MD_CTX_free(ctx[i]);
+      free(buff[i]);
+    }
+  }
+  EVP_MD_CTX_free(j.salted);
+  free(j.hashes);
+  return ret;
+}
+
+size_t merkle_measure_verity(FILE* f, uint8_t* hash_algorithm,
+			     char* buf, size_t size)
+{
+  union {
+    struct fsverity_digest d;
+    char raw[sizeof(struct fsverity_digest) + 64];
+  } u;
+  u.d.digest_size = sizeof(u.raw) - sizeof(u.d);
+  if(ioctl(fileno(f), FS_IOC_MEASURE_VERITY, &u.d) != 0)
+    return 0;// ENODATA if f has no fs-verity.
+  if(u.d.digest_size > size)
+    return 0;
+  *hash_algorithm = u.d.digest_algorithm;
+  memcpy(buf, u.d.digest, u.d.digest_size);
+  return u.d.digest_size;
+}
+
+void merkle_report(const merkle_params* p, const merkle_info* info,
+		   const char* name, FILE* fp)
+{
+  size_t i = 0;
+  fprintf(fp, "merkle tree of %s: fs-verity v1, %s, block size %zu, salt ",
+	  name, p->mdname, p->block_size);
+  if(p->salt_size == 0)
+    fputs("none", fp);
+  for(i = 0; i < p->salt_size; i++)
+    fprintf(fp, "%02x", p->salt[i]);
+  fprintf(fp, ", data size %llu, %zu level(s), root hash ",
+	  (unsigned long long)info->data_size, info->levels);
+  for(i = 0; i < info->root_size; i++)
+    fprintf(fp, "%02x", info->root_hash[i]);
+  fputs("\n", fp);
+}
@@ -0,0 +1,121 @@
+/* 
+ * merkle.h
+ * parallel merkle tree measurement of files and block devices,
+ * compatible with the file digest of fs-verity.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _MERKLE_H_
+#define _MERKLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include "md.h"
+#include <stdint.h>
+
+/*
+ * A single stream of sha could use only one core, so huge files and block
+ * devices could be measured as a merkle tree instead, whose leaves are
+ * hashes of fixed-size data blocks, which could be computed on all cores.
+ *
+ * The tree is built the way fs-verity does: hashes are packed into blocks
+ * of the same size as data blocks, the last block of each level is padded
+ * with zeros, and every block hashed is prefixed with the salt (if any),
+ * padded to the block size of the hash function. Levels are built from
+ * the data blocks up until one has only one block, whose hash is the root
+ * hash; so a file of one block has no tree at all, and the hash of its
+ * (zero-padded) data block is the root hash. The digest measured is that
+ * of a fsverity_descriptor holding the root hash. So the digest is
+ * identical to what FS_IOC_MEASURE_VERITY reports for the same
+ * file with the same parameters, and could be reproduced with
+ * "fsverity digest" of fsverity-utils.
+ *
+ * Only sha256 and sha512 are defined by fs-verity.
+ */
+
+#define MERKLE_DEFAULT_BLOCK_SIZE ((size_t)4096)
+#define MERKLE_MAX_SALT_SIZE 32
+
+typedef struct merkle_params {
+  const char* mdname;
+  size_t block_size; //a power of 2, from 1024 to 65536.
+  size_t salt_size;
+  unsigned char salt[MERKLE_MAX_SALT_SIZE];
+} merkle_params;
+
+typedef struct merkle_info {
+  uint8_t hash_algorithm; //as FS_VERITY_HASH_ALG_*.
+  uint64_t data_size;
+  size_t levels; //of hash blocks, 0 for up to one data block.
+  size_t root_size;
+  unsigned char root_hash[EVP_MAX_MD_SIZE];
+} merkle_info;
+
+bool merkle_params_check(const merkle_params* p);
+// returns FS_VERITY_HASH_ALG_* of mdname, or 0 if fs-verity lacks it.
+uint8_t merkle_alg_id(const char* mdname);
+
+/*
+ * Compute the fs-verity file digest of f (a regular file or a block
+ * device) with up to workers threads, into buf.
+ * returns the size of the digest, or 0 on failure.
+ */
+size_t merkle_digest_file(const merkle_params* p, FILE* f, size_t workers,
+			  char* buf, size_t size, merkle_info* info);
+
+/*
+ * For a file with fs-verity enabled, the kernel already holds its
+ * authenticated file digest, so ask for it with FS_IOC_MEASURE_VERITY
+ * instead of reading the file. Note that the digest is computed with the
+ * block size and salt the file was enabled with.
+ * returns the size of the digest, or 0 if f has no fs-verity, or the
+ * kernel or filesystem lacks it.
+ */
+size_t merkle_measure_verity(FILE* f, uint8_t* hash_algorithm,
+			     char* buf, size_t size);
+
+// print parameters of the tree, for verifiers to reproduce the root.
+void merkle_report(const merkle_params* p, const merkle_info* info,
+		   const char* name, FILE* fp);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
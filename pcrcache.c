@@ -0,0 +1,183 @@
+/* 
+ * pcrcache.c
+ * A cache of pcr values, valid while pcrUpdateCounter is unchanged.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "pcrcache.h"
+#include "tpmdetect.h"
+#include <string.h>
+#include <unistd.h>
+
+#define PCRCACHE_MAGIC "pcrcach"
+
+typedef struct pcrcache {
+  char magic[8];
+  char boot_id[40];
+  char tpm[8]; // tpm_version, not to take values of a soft tpm, say.
+  uint32_t counter;
+  uint32_t nalg;
+  uint32_t algs[PCRCACHE_BANKS];
+  uint32_t valid[PCRCACHE_BANKS]; // masks of pcrs cached on each bank.
+  pcr values[PCRCACHE_BANKS * PCR_NUM];
+} pcrcache;
+
+static bool pcrcache_load(const char* path, pcrcache* c, const char* boot,
+			  const char* tpm)
+{
+  FILE* f = fopen(path, "rb");
+  bool ok = false;
+  if(f == NULL)
+    return false;
+  ok = (fread(c, sizeof(*c), 1, f) == 1
+	&& 0 == memcmp(c->magic, PCRCACHE_MAGIC, sizeof(c->magic))
+	&& 0 == strncmp(c->boot_id, boot, sizeof(c->boot_id))
+	&& 0 == strncmp(c->tpm, tpm, sizeof(c->tpm))
+	&& c->nalg <= PCRCACHE_BANKS);
+  fclose(f);
+  return ok;
+}
+
+// written aside and renamed, as tpmdetect_save() does.
+static bool pcrcache_save(const char* path, const pcrcache* c)
+{
+  char tmp[256];
+  if(snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid())
+     >= (int)sizeof(tmp))
+    return false;
+  FILE* f = fopen(tmp, "wb");
+  if(f == NULL)
+    return false;
+  bool ok = (fwrite(c, sizeof(*c), 1, f) == 1);
+  ok = (fclose(f) == 0) && ok;
+  if(ok)
+    ok = (rename(tmp, path) == 0);
+  if(!ok)
+    unlink(tmp);
+  return ok;
+}
+
+static void pcrcache_reset(pcrcache* c, const char* boot, const char* tpm,
+			   uint32_t counter)
+{
+  memset(c, 0, sizeof(*c));
+  memcpy(c->magic, PCRCACHE_MAGIC, sizeof(c->magic));
+  snprintf(c->boot_id, sizeof(c->boot_id), "%s", boot);
+  snprintf(c->tpm, sizeof(c->tpm), "%s", tpm);
+  c->counter = counter;
+}
+
+// the slot of alg in c, taking a free one if add, or -1.
+static int pcrcache_bank(pcrcache* c, uint32_t alg, bool add)
+{
+  uint32_t b = 0;
+  for(; b < c->nalg; b++)
+    if(c->algs[b] == alg)
+      return b;
+  if(!add || c->nalg == PCRCACHE_BANKS)
+    return -1;
+  c->algs[c->nalg] = alg;
+  c->valid[c->nalg] = 0;
+  return c->nalg ++;
+}
+
+uint32_t pcrcache_read(const char* path, pcr_context_base* ctx,
+		       const uint32_t* algs, size_t nalg,
+		       uint32_t pcr_mask, pcr* pcrvalues, uint32_t* cached)
+{
+  pcrcache c;
+  char boot[40];
+  const char* tpm = ctx->vtbl->tpm_version;
+  uint32_t counter = 0;
+  uint32_t served = pcr_mask & ~PCR_UNCOUNTED;
+  uint32_t rest = 0;
+  uint32_t ret = 0;
+  size_t k = 0;
+
+  *cached = 0;
+  if(!tpmdetect_boot_id(boot, sizeof(boot)))
+    boot[0] = '\0';
+  ret = tpm_pcr_read_counter(ctx, NULL, 0, 0, NULL, &counter);
+  if(ret != 0)
+    return ret;
+  if(!pcrcache_load(path, &c, boot, tpm) || c.counter != counter)
+    pcrcache_reset(&c, boot, tpm, counter);
+
+  for(; k < nalg; k++) {
+    int b = pcrcache_bank(&c, algs[k], false);
+    served &= (b < 0)? 0: c.valid[b];
+  }
+  for(k = 0; k < nalg; k++) {
+    int b = pcrcache_bank(&c, algs[k], false);
+    size_t i = 0;
+    for(; i < PCR_NUM; i++) {
+      pcrvalues[k * PCR_NUM + i].s = 0;
+      if(served & (1u << i))
+	pcrvalues[k * PCR_NUM + i] = c.values[b * PCR_NUM + i];
+    }
+  }
+
+  rest = pcr_mask & ~served;
+  if(rest != 0) {
+    pcr values[nalg * PCR_NUM];
+    uint32_t now = 0;
+    ret = tpm_pcr_read_counter(ctx, algs, nalg, rest, values, &now);
+    if(ret != 0)
+      return ret;
+    if(now != counter) {
+      // updated since the check, so the values served are stale as well.
+      served = 0;
+      rest = pcr_mask;
+      ret = tpm_pcr_read_counter(ctx, algs, nalg, rest, values, &now);
+      if(ret != 0)
+	return ret;
+      pcrcache_reset(&c, boot, tpm, now);
+    }
+    for(k = 0; k < nalg; k++) {
+      int b = pcrcache_bank(&c, algs[k], true);
+      size_t i = 0;
+      for(; i < PCR_NUM; i++) {
+	if(!(rest & (1u << i)))
+	  continue;
+	pcrvalues[k * PCR_NUM + i] = values[k * PCR_NUM + i];
+	if(b >= 0 && !(PCR_UNCOUNTED & (1u << i))) {
+	  c.values[b * PCR_NUM + i] = values[k * PCR_NUM + i];
+	  c.valid[b] |= 1u << i;
+	}
+      }
+    }
+    // a cache which could not be saved is only slower.
+    if((rest & ~PCR_UNCOUNTED) != 0)
+      pcrcache_save(path, &c);
+  }
+  *cached = served;
+  return 0;
+}
@@ -0,0 +1,76 @@
+/* 
+ * pcrcache.h
+ * A cache of pcr values, valid while pcrUpdateCounter is unchanged.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _PCRCACHE_H_
+#define _PCRCACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include "tpm_common.h"
+
+/*
+ * A tpm2 counts updates of its pcrs in pcrUpdateCounter, which every
+ * PCR_Read returns. Values read are saved in a file along with the
+ * counter (and the boot_id), and a later read finding the counter the
+ * same, with a PCR_Read of no pcr, takes them from the file instead.
+ * pcrs 16-23 (PCR_UNCOUNTED), whose updates may not be counted, are
+ * always read from the tpm.
+ */
+
+#define PCRCACHE_DEFAULT "/run/pcrtool.pcrs"
+#define PCRCACHE_BANKS 5
+
+/*
+ * read as pcr_read_multi does, through the cache at path, for a ctx which
+ * tpm_has_update_counter(). pcrs served from the cache are set in
+ * *cached. the cache is updated with the pcrs read from the tpm, and is
+ * left alone if the file is not usable.
+ */
+uint32_t pcrcache_read(const char* path, pcr_context_base* ctx,
+		       const uint32_t* algs, size_t nalg,
+		       uint32_t pcr_mask, pcr* pcrvalues, uint32_t* cached);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
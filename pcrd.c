@@ -0,0 +1,540 @@
+/* 
+ * pcrd.c
+ * A daemon holding a tpm context open, to serve pcr operations over a
+ * unix socket, and the client side of it as a pcr_vtbl.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#define _GNU_SOURCE // for accept4
+#include "pcrd.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static const char* pcrd_socket = PCRD_DEFAULT_SOCKET;
+static char pcrd_version[8];
+
+void pcrd_set_socket(const char* path)
+{
+  pcrd_socket = path;
+}
+
+const char* pcrd_remote_version(void)
+{
+  return pcrd_version;
+}
+
+static int pcrd_sockaddr(const char* path, struct sockaddr_un* sa)
+{
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(sa->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(sa->sun_path, path);
+  return 0;
+}
+
+/*
+ * the daemon.
+ */
+
+typedef struct pcrd_client {
+  int fd;
+  pcrd_request req;
+} pcrd_client;
+
+static volatile sig_atomic_t pcrd_stop = 0;
+
+static void pcrd_onsignal(int sig)
+{
+  pcrd_stop = 1;
+}
+
+static bool pcrd_request_isvalid(const pcrd_request* req)
+{
+  size_t k = 0;
+  size_t len = 0;
+  if(req->version != PCRD_VERSION)
+    return false;
+  if(req->op == PCRD_OP_INFO)
+    return true;
+  if(req->nalg > PCRD_MAX_BANKS
+     || req->pcr_mask == 0
+     || req->pcr_mask >= (1u << PCR_NUM))
+    return false;
+  if(req->op == PCRD_OP_READ)
+    return req->nalg > 0;
+  if(req->op == PCRD_OP_RESET)
+    return true;
+  if((req->pcr_mask & (req->pcr_mask - 1)) != 0)
+    return false;
+  if(req->op != PCRD_OP_EXTEND || req->nalg == 0)
+    return false;
+  for(; k < req->nalg; k++) {
+    if(req->datalen[k] > PCRSIZE)
+      return false;
+    len += req->datalen[k];
+  }
+  return len <= sizeof(req->data);
+}
+
+static void pcrd_reply(pcr_context_base* ctx, pcrd_client* c,
+		       pcrd_response* resp)
+{
+  strncpy(resp->tpm_version, ctx->vtbl->tpm_version,
+	  sizeof(resp->tpm_version) - 1);
+  resp->tpm_version[sizeof(resp->tpm_version) - 1] = '\0';
+  if(send(c->fd, resp, sizeof(*resp), MSG_NOSIGNAL | MSG_DONTWAIT)
+     != sizeof(*resp)) {
+    /*
+     * the client is gone, or does not read its replies, and must not
+     * block the others. it will be found closed by the next poll.
+     */
+    shutdown(c->fd, SHUT_RDWR);
+  }
+}
+
+static void pcrd_serve_one(pcr_context_base* ctx, pcrd_client* c,
+			   pcrd_response* resp)
+{
+  pcrd_request* req = &c->req;
+  memset(resp, 0, sizeof(*resp));
+  switch(req->op) {
+  case PCRD_OP_INFO:
+    break;
+  case PCRD_OP_EXTEND:
+    // pcrd_request_isvalid() took only masks of a single pcr.
+    resp->ret = tpm_pcr_extend_multi(ctx, __builtin_ctz(req->pcr_mask),
+				     req->algs, req->nalg,
+				     req->data, req->datalen,
+				     req->readback? resp->values: NULL);
+    break;
+  case PCRD_OP_RESET:
+    resp->ret = tpm_pcr_reset_multi(ctx, req->pcr_mask);
+    break;
+  default:
+    resp->ret = PCRD_E_PROTOCOL;
+    break;
+  }
+  pcrd_reply(ctx, c, resp);
+}
+
+/*
+ * read for a run of read requests with one pcr_read_multi(), over the
+ * union of their banks, as long as it does not exceed PCRD_MAX_BANKS.
+ * returns how many requests of the run are served.
+ */
+static size_t pcrd_serve_reads(pcr_context_base* ctx, pcrd_client** run,
+			       size_t n, pcrd_response* resp)
+{
+  uint32_t algs[PCRD_MAX_BANKS];
+  size_t nalg = 0;
+  uint32_t mask = 0;
+  size_t i = 0;
+  for(; i < n && run[i]->req.op == PCRD_OP_READ; i++) {
+    uint32_t merged[PCRD_MAX_BANKS];
+    size_t nmerged = nalg;
+    size_t k = 0;
+    memcpy(merged, algs, sizeof(algs));
+    for(; k < run[i]->req.nalg; k++) {
+      size_t j = 0;
+      for(; j < nmerged && merged[j] != run[i]->req.algs[k]; j++);
+      if(j < nmerged)
+	continue;
+      if(nmerged == PCRD_MAX_BANKS)
+	break;
+      merged[nmerged++] = run[i]->req.algs[k];
+    }
+    if(k < run[i]->req.nalg)
+      break;
+    memcpy(algs, merged, sizeof(algs));
+    nalg = nmerged;
+    mask |= run[i]->req.pcr_mask;
+  }
+  n = i;
+
+  pcr values[PCRD_MAX_BANKS * PCR_NUM];
+  uint32_t ret = tpm_pcr_read_multi(ctx, algs, nalg, mask, values);
+  for(i = 0; i < n; i++) {
+    const pcrd_request* req = &run[i]->req;
+    size_t k = 0;
+    memset(resp, 0, sizeof(*resp));
+    resp->ret = ret;
+    for(; k < req->nalg && ret == 0; k++) {
+      size_t j = 0;
+      uint32_t p = 0;
+      for(; algs[j] != req->algs[k]; j++);
+      for(; p < PCR_NUM; p++) {
+	if(req->pcr_mask & (1u << p))
+	  resp->values[k * PCR_NUM + p] = values[j * PCR_NUM + p];
+      }
+    }
+    pcrd_reply(ctx, run[i], resp);
+  }
+  return n;
+}
+
+static int pcrd_listen(const char* path)
+{
+  struct sockaddr_un sa;
+  struct stat st;
+  if(pcrd_sockaddr(path, &sa) != 0)
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if(fd < 0)
+    return -1;
+
+  /*
+   * a socket left by a daemon before, but never anything else, nor the
+   * socket of a daemon still serving there.
+   */
+  if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    int r = (probe >= 0)? connect(probe, (struct sockaddr*)&sa, sizeof(sa)): -1;
+    int err = (r == 0)? EADDRINUSE: errno;
+    if(probe >= 0)
+      close(probe);
+    if(err != ECONNREFUSED) {
+      close(fd);
+      errno = err;
+      return -1;
+    }
+    unlink(path);
+  }
+  mode_t mask = umask(0177); // only the owner could talk to the tpm.
+  int r = bind(fd, (struct sockaddr*)&sa, sizeof(sa));
+  umask(mask);
+  if(r != 0 || listen(fd, PCRD_MAX_CLIENTS) != 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+int pcrd_serve(pcr_context_base* ctx, const char* path)
+{
+  int lfd = pcrd_listen(path);
+  if(lfd < 0)
+    return -1;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = pcrd_onsignal; // no SA_RESTART, to break poll().
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  pcrd_client* clients = (pcrd_client*)calloc(PCRD_MAX_CLIENTS,
+					      sizeof(pcrd_client));
+  pcrd_client** run = (pcrd_client**)calloc(PCRD_MAX_CLIENTS,
+					    sizeof(pcrd_client*));
+  pcrd_response* resp = (pcrd_response*)malloc(sizeof(pcrd_response));
+  struct pollfd fds[PCRD_MAX_CLIENTS + 1];
+  size_t nclient = 0;
+  int ret = 0;
+  if(clients == NULL || run == NULL || resp == NULL) {
+    ret = -1;
+    pcrd_stop = 1;
+  }
+
+  while(!pcrd_stop) {
+    size_t i = 0;
+    size_t n = 0;
+    fds[0] = (struct pollfd){lfd, POLLIN, 0};
+    for(; i < nclient; i++)
+      fds[i + 1] = (struct pollfd){clients[i].fd, POLLIN, 0};
+    if(poll(fds, nclient + 1, -1) < 0)
+      continue; // EINTR, and pcrd_stop is likely set.
+
+    // take one request from each client ready, in the order of clients.
+    for(i = 0; i < nclient; i++) {
+      pcrd_client* c = &clients[i];
+      if(fds[i + 1].revents == 0)
+	continue;
+      ssize_t r = recv(c->fd, &c->req, sizeof(c->req), MSG_DONTWAIT);
+      if(r < 0 && (errno == EAGAIN || errno == EINTR))
+	continue;
+      if(r != sizeof(c->req) || !pcrd_request_isvalid(&c->req)) {
+	// a short request is a broken client, as well as a closed one.
+	close(c->fd);
+	c->fd = -1;
+	continue;
+      }
+      run[n++] = c;
+    }
+
+    for(i = 0; i < n;) {
+      if(run[i]->req.op == PCRD_OP_READ) {
+	i += pcrd_serve_reads(ctx, run + i, n - i, resp);
+      } else {
+	pcrd_serve_one(ctx, run[i], resp);
+	i ++;
+      }
+    }
+
+    // drop clients closed, and accept new ones.
+    for(i = 0, n = 0; i < nclient; i++) {
+      if(clients[i].fd >= 0)
+	clients[n++].fd = clients[i].fd;
+    }
+    nclient = n;
+    while(fds[0].revents & POLLIN) {
+      int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+      if(fd < 0)
+	break;
+      if(nclient == PCRD_MAX_CLIENTS)
+	close(fd);
+      else
+	clients[nclient++].fd = fd;
+    }
+  }
+
+  {
+    size_t i = 0;
+    for(; i < nclient; i++)
+      close(clients[i].fd);
+  }
+  free(clients);
+  free(run);
+  free(resp);
+  close(lfd);
+  unlink(path);
+  return ret;
+}
+
+/*
+ * the client, as a vtbl, which keeps the socket in privdata[0], and the
+ * algorithm set by ctx_setalg in privdata[1].
+ */
+
+static uint32_t pcrd_call(pcr_context_base* ctx, pcrd_request* req,
+			  pcrd_response* resp)
+{
+  int fd = (int)ctx->privdata[0];
+  ssize_t r = 0;
+  req->version = PCRD_VERSION;
+  if(send(fd, req, sizeof(*req), MSG_NOSIGNAL) != sizeof(*req))
+    return PCRD_E_IO;
+  do {
+    r = recv(fd, resp, sizeof(*resp), 0);
+  } while(r < 0 && errno == EINTR);
+  if(r != sizeof(*resp))
+    return PCRD_E_IO;
+  return resp->ret;
+}
+
+static FP_tpm_errout(pcrd_errout)
+{
+  const char* why = "";
+  switch(ret) {
+  case PCRD_E_IO:
+    why = " (lost connection to pcrtool daemon)";
+    break;
+  case PCRD_E_PROTOCOL:
+    why = " (request refused by pcrtool daemon)";
+    break;
+  case PCRD_E_UNSUPPORTED:
+    why = " (not supported through pcrtool daemon)";
+    break;
+  }
+  fprintf(stderr, "%s0x%x%s\n", message, ret, why);
+  return ret;
+}
+
+static FP_ctx_init(pcrd_ctx_init)
+{
+  struct sockaddr_un sa;
+  pcrd_request req;
+  pcrd_response resp;
+  uint32_t ret = 0;
+
+  ctx->privdata[0] = (uintptr_t)-1;
+  ctx->privdata[1] = 0;
+  if(pcrd_sockaddr(pcrd_socket, &sa) != 0)
+    return PCRD_E_IO;
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if(fd < 0)
+    return PCRD_E_IO;
+  if(connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) {
+    close(fd);
+    return PCRD_E_IO;
+  }
+  ctx->privdata[0] = fd;
+
+  memset(&req, 0, sizeof(req));
+  req.op = PCRD_OP_INFO;
+  ret = pcrd_call(ctx, &req, &resp);
+  if(ret == 0) {
+    memcpy(pcrd_version, resp.tpm_version, sizeof(pcrd_version));
+    pcrd_version[sizeof(pcrd_version) - 1] = '\0';
+  }
+  return ret;
+}
+
+static FP_ctx_uninit(pcrd_ctx_uninit)
+{
+  int fd = (int)ctx->privdata[0];
+  if(fd >= 0)
+    close(fd);
+  ctx->privdata[0] = (uintptr_t)-1;
+  return 0;
+}
+
+static FP_ctx_freemem(pcrd_ctx_freemem)
+{
+  free(ptr);
+}
+
+static FP_pcr_read_multi(pcrd_pcr_read_multi)
+{
+  pcrd_request req;
+  pcrd_response resp;
+  uint32_t ret = 0;
+  if(nalg == 0 || nalg > PCRD_MAX_BANKS)
+    return PCRD_E_PROTOCOL;
+
+  memset(&req, 0, sizeof(req));
+  req.op = PCRD_OP_READ;
+  req.pcr_mask = pcr_mask;
+  req.nalg = nalg;
+  memcpy(req.algs, algs, nalg * sizeof(algs[0]));
+  ret = pcrd_call(ctx, &req, &resp);
+  if(ret == 0)
+    memcpy(pcrvalues, resp.values, nalg * PCR_NUM * sizeof(pcr));
+  return ret;
+}
+
+static FP_pcr_read(pcrd_pcr_read)
+{
+  uint32_t alg = ctx->privdata[1];
+  pcr values[PCR_NUM];
+  uint32_t ret = pcrd_pcr_read_multi(ctx, &alg, 1, 1u << pcr_index, values);
+  if(ret == 0)
+    *pcrvalue = values[pcr_index];
+  return ret;
+}
+
+static FP_pcr_extend_multi(pcrd_pcr_extend_multi)
+{
+  pcrd_request req;
+  pcrd_response resp;
+  uint32_t ret = 0;
+  size_t len = 0;
+  size_t k = 0;
+  if(nalg == 0 || nalg > PCRD_MAX_BANKS)
+    return PCRD_E_PROTOCOL;
+
+  memset(&req, 0, sizeof(req));
+  req.op = PCRD_OP_EXTEND;
+  req.pcr_mask = 1u << pcr_index;
+  req.readback = (newvalues != NULL);
+  req.nalg = nalg;
+  for(; k < nalg; k++) {
+    if(datalen[k] > PCRSIZE)
+      return PCRD_E_PROTOCOL;
+    req.algs[k] = algs[k];
+    req.datalen[k] = datalen[k];
+    len += datalen[k];
+  }
+  memcpy(req.data, data, len);
+  ret = pcrd_call(ctx, &req, &resp);
+  if(ret == 0 && newvalues != NULL)
+    memcpy(newvalues, resp.values, nalg * sizeof(pcr));
+  return ret;
+}
+
+static FP_pcr_extend(pcrd_pcr_extend)
+{
+  uint32_t alg = ctx->privdata[1];
+  return pcrd_pcr_extend_multi(ctx, pcr_index, &alg, 1,
+			       data, &datalen, newvalue);
+}
+
+static FP_pcr_reset_multi(pcrd_pcr_reset_multi)
+{
+  pcrd_request req;
+  pcrd_response resp;
+  memset(&req, 0, sizeof(req));
+  req.op = PCRD_OP_RESET;
+  req.pcr_mask = pcr_mask;
+  return pcrd_call(ctx, &req, &resp);
+}
+
+static FP_pcr_reset(pcrd_pcr_reset)
+{
+  return pcrd_pcr_reset_multi(ctx, 1u << pcr_index);
+}
+
+static FP_ctx_setalg(pcrd_ctx_setalg)
+{
+  ctx->privdata[1] = alg;
+}
+
+static FP_pcr_setalg(pcrd_pcr_setalg)
+{
+  return PCRD_E_UNSUPPORTED;
+}
+
+static const tpm2_spec_vtbl pcrd_vt2 = (tpm2_spec_vtbl){
+  pcrd_ctx_setalg,
+  pcrd_pcr_setalg,
+  NULL,
+  NULL,
+  NULL,
+  NULL
+};
+
+const pcr_vtbl pcrd_client_vtbl
+= (pcr_vtbl) {
+  "remote",
+  &pcrd_vt2,
+
+  pcrd_errout,
+  pcrd_ctx_init,
+  pcrd_ctx_uninit,
+  pcrd_ctx_freemem,
+  pcrd_pcr_read,
+  pcrd_pcr_extend,
+  pcrd_pcr_reset,
+  pcrd_pcr_read_multi,
+  pcrd_pcr_extend_multi,
+  pcrd_pcr_reset_multi
+};
@@ -0,0 +1,119 @@
+/* 
+ * pcrd.h
+ * A daemon holding a tpm context open, to serve pcr operations over a
+ * unix socket, and the client side of it as a pcr_vtbl.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _PCRD_H_
+#define _PCRD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include "tpm_common.h"
+
+/*
+ * Every request and response is a single fixed-size message over a
+ * SOCK_SEQPACKET unix socket, and each client has at most one request
+ * in flight. The daemon polls all its clients, takes one request from
+ * each client ready in a round, and serves them in the order clients were
+ * accepted (not that of arrival), except that a run of reads next to each
+ * other in that order is coalesced into one pcr_read_multi() over the
+ * union of their pcrs and banks.
+ *
+ * Banks are given as tpm2 algorithm ids, as for pcr_read_multi(), and
+ * are ignored by a daemon on tpm1.
+ */
+
+#define PCRD_DEFAULT_SOCKET "/run/pcrtool.sock"
+#define PCRD_VERSION 1
+#define PCRD_MAX_BANKS 5
+#define PCRD_MAX_CLIENTS 256
+
+enum {
+  PCRD_OP_INFO = 1,
+  PCRD_OP_READ,
+  PCRD_OP_EXTEND,
+  PCRD_OP_RESET,
+};
+
+// errors of the daemon or the connection, rather than of the tpm.
+#define PCRD_E_IO 0x70cd0001
+#define PCRD_E_PROTOCOL 0x70cd0002
+#define PCRD_E_UNSUPPORTED 0x70cd0003
+
+typedef struct pcrd_request {
+  uint32_t version;
+  uint32_t op;
+  uint32_t pcr_mask; // pcrs to read or reset, or a single one to extend.
+  uint32_t readback; // whether extend returns new values.
+  uint32_t nalg;
+  uint32_t algs[PCRD_MAX_BANKS];
+  uint32_t datalen[PCRD_MAX_BANKS];
+  char data[PCRD_MAX_BANKS * PCRSIZE];
+} pcrd_request;
+
+typedef struct pcrd_response {
+  uint32_t ret;
+  char tpm_version[8];
+  // as pcr_read_multi() fills them, or a value per bank for extend.
+  pcr values[PCRD_MAX_BANKS * PCR_NUM];
+} pcrd_response;
+
+/*
+ * serve on the socket at path until SIGINT or SIGTERM, with ctx already
+ * initialized. returns 0, or -1 with errno set if the socket could not be
+ * set up.
+ */
+int pcrd_serve(pcr_context_base* ctx, const char* path);
+
+/*
+ * the vtbl to talk to a daemon, at the socket set by pcrd_set_socket()
+ * (PCRD_DEFAULT_SOCKET by default). pcrd_remote_version() is the
+ * tpm_version of the daemon's tpm, once connected.
+ */
+extern const pcr_vtbl pcrd_client_vtbl;
+void pcrd_set_socket(const char* path);
+const char* pcrd_remote_version(void);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
@@ -34,28 +34,146 @@
 
 #include "tpm_common.h"
 #include "tpm2_md_alg.h"
+#include "tpm12_timeout.h"
 #include "md.h"
+#include "mdcache.h"
+#include "merkle.h"
+#include "mdtree.h"
+#include "pcrd.h"
+#include "tpmdetect.h"
+#include "softtpm.h"
+#include "stats.h"
+#include "pcrcache.h"
+#include "quote.h"
+#include "policy.h"
+#include "eventlog.h"
+#include "workq.h"
+#include <openssl/pem.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
 
 const char usagefmt[]
 = "Usage: %s [option] command <index-of-a-pcr or cfgstr> [files]\n"
   "Commands:\n"
   "\n"
-  "read - read the value of the pcr whose index is given.\n"
+  "read - read the value of the pcr whose index is given. a list of\n"
+  "\tindexes and ranges, e.g. 0,4,7-10, or \"all\" reads several pcrs\n"
+  "\ton every bank given to -a at once.\n"
   "extend - extend the value of the pcr with the hashsums\n"
   "\tof given files, and output the new value.\n"
-  "clear - reset the value of the pcr to its initial state.\n"
+  "watch - print the pcrs given, as read does, then every pcr of them\n"
+  "\tchanged, polled every --interval, until SIGINT or SIGTERM. on tpm2,\n"
+  "\ta poll reads only pcrUpdateCounter (and pcrs 16 to 23, which it\n"
+  "\tmay not count), unless the counter moves.\n"
+  "clear - reset the value of the pcr to its initial state. a list of\n"
+  "\tindexes and ranges, as to read, resets them all with one command on\n"
+  "\ttpm1, and with commands one after another on tpm2.\n"
+  "daemon - hold the tpm open, and serve read, extend and clear of other\n"
+  "\tpcrtools at the socket given by --socket, " PCRD_DEFAULT_SOCKET "\n"
+  "\tby default, until SIGINT or SIGTERM. takes no operand.\n"
+  "quote - (for TPM2 only) quote the pcrs given on every bank given to -a\n"
+  "\twith the attestation key at --ak, and write the quote, along with\n"
+  "\tthe values quoted, to stdout or -o.\n"
+  "verify-quote - check quotes written by quote, in files given, against\n"
+  "\tthe key at --ak-pub and --nonce, on -j N threads, without a tpm.\n"
+  "policy - compute the digest a TPM2_PolicyPCR over the pcrs of a\n"
+  "\tselection, given as to setalg, reaches with values predicted in each\n"
+  "\tfile given, in the format of read, on -j N threads without a tpm.\n"
+  "\t-a gives the algorithm of the policy. a value may be given as\n"
+  "\t@FILE, for the pcr extended once from zeros with the digest of\n"
+  "\tFILE, e.g. \"PCR 16:sha256:@manifest\", as extend --tree leaves it.\n"
+  "\tthe manifest must be of that algorithm, as --manifest writes it for\n"
+  "\tthe first algorithm given to -a only.\n"
   "setalg - (for TPM2 only) enable a bitmap of pcr on the bank of an algorithm,\n"
   "\tneeds a configure string in \"alg1:map1+alg2:map2...n\" format.\n"
   "Options:\n"
   "-a - select hash algorithm - default to sha1.\n"
   "\tnote: on TPM2, algorithm for file must match with pcr's bank algorithm.\n"
+  "\ta comma-separated list (e.g. sha1,sha256) extends all of these banks\n"
+  "\tin one run, while every file is read only once.\n"
   "-b - output pcr value as raw binary, rather than hex string.\n"
-  "-o - write to a file instead of stdout.\n"
+  "-o - write to a file instead of stdout (stderr with --stream).\n"
+  "--io-mode=read|mmap|uring|uring-direct - how to read files to hash\n"
+  "\t- default to read. mmap saves a copy, but a file truncated while it\n"
+  "\tis mapped kills pcrtool with SIGBUS. uring keeps several reads in\n"
+  "\tflight with io_uring, and uring-direct does so with O_DIRECT. they\n"
+  "\tall fall back to read for pipes and special files.\n"
+  "--buffer-size=N[k|m|g] - size of buffer used to read files,\n"
+  "\tdefault to 1m.\n"
+  "-j N - hash up to N files concurrently when extending, default to 1.\n"
+  "\tpcrs are still extended in the order of given files.\n"
+  "--cache=FILE - reuse digests of files unchanged since they were hashed\n"
+  "\tlast time, which are kept in FILE. (trusts metadata of files!)\n"
+  "--cache-verify=PERCENT - hash a random sample of cached files anyway,\n"
+  "\tand warn if their digests mismatch.\n"
+  "--measure=stream|merkle - how to digest a file - default to stream.\n"
+  "\tmerkle hashes blocks of a file or block device on -j N threads into\n"
+  "\ta merkle tree, and measures its fs-verity file digest (sha256 or\n"
+  "\tsha512 only), with parameters of the tree printed on stderr.\n"
+  "--merkle-block-size=N - size of blocks of the merkle tree, default to 4k.\n"
+  "--merkle-salt=HEX - salt of the merkle tree, up to 32 bytes.\n"
+  "--verity[=match|any] - measure files having fs-verity enabled with\n"
+  "\ttheir fs-verity digests held by the kernel, without reading them.\n"
+  "\tmatch (the default) does so only if the algorithm of the digest\n"
+  "\tmatches all banks, while any extends banks of other algorithms\n"
+  "\twith the hash of the digest. other files are digested as usual,\n"
+  "\tand with --measure=merkle, to the same digest fs-verity reports\n"
+  "\tfor them once enabled with the same block size and salt (4k and\n"
+  "\tnone, as fsverity enable does by default).\n"
+  "--stream - extend with data passed through from stdin to stdout,\n"
+  "\tonce stdin reaches EOF, instead of files given. data is hashed on the\n"
+  "\tway, with tee and splice when stdin is a pipe.\n"
+  "--tpm=1.2|2|auto|soft - the version of tpm to use. auto (default) takes\n"
+  "\tthe version found before, saved in " TPMDETECT_CACHE " until the next\n"
+  "\tboot, or the one the kernel reports in sysfs, and probes for a tpm1\n"
+  "\tthen a tpm2 only if neither is known. soft is a tpm2 of pcrs only,\n"
+  "\tin memory, for tests and benchmarks.\n"
+  "--tpm-timeout=MS - give up connecting to tcsd of a tpm1 after MS\n"
+  "\tmilliseconds, moving on to a tpm2 when probing, and fail its commands\n"
+  "\ttaking longer. 0 waits for ever. default to 5000.\n"
+  "--soft-state=FILE - keep pcrs of the soft tpm in FILE, to last across\n"
+  "\truns, rather than in memory.\n"
+  "--socket=PATH - talk to a pcrtool daemon at PATH, rather than to a\n"
+  "\ttpm, which costs a round trip on the socket instead of setting up\n"
+  "\tthe tpm for every run; with daemon, the socket to serve at.\n"
+  "--readback=each|final|verify - read the new value of the pcr after\n"
+  "\tevery extend (default), only once after all, or also once before\n"
+  "\tall, to check the value after against the one computed in software,\n"
+  "\twhich fails if the pcr is extended by others meanwhile. TPM1 returns\n"
+  "\tthe new value along with every extend, so it always reads \"each\".\n"
+  "--tree=DIR - extend with all regular files under DIR instead of files\n"
+  "\tgiven, which are listed with -j N threads and sorted by path.\n"
+  "--tree-mode=manifest|files - with --tree, extend once with the digest\n"
+  "\tof the manifest of DIR (default), or once per file in sorted order.\n"
+  "\tthe manifest lists files in sorted order, in the format of sha1sum.\n"
+  "--manifest=FILE - with --tree, write the manifest (of the first\n"
+  "\talgorithm given to -a) into FILE.\n"
+  "--event-log=FILE - with extend, append an event of every extend to\n"
+  "\tFILE, a TCG crypto agile log (as of firmware), with digests of all\n"
+  "\tbanks and the path of the file, to be replayed by verifiers.\n"
+  "--pcr-cache[=FILE] - with read on tpm2, take pcrs from FILE, "
+  PCRCACHE_DEFAULT "\n"
+  "\tby default, if pcrUpdateCounter is the same as they were read at,\n"
+  "\tand save the ones read from the tpm into it. pcrs 16 to 23, which\n"
+  "\tthe counter may not count, are always read from the tpm.\n"
+  "--interval=MS - milliseconds between polls of watch, 2000 by default.\n"
+  "--ak=HANDLE - handle of a loaded or persistent attestation key to quote\n"
+  "\twith, e.g. 0x81010002.\n"
+  "--ak-pub=FILE - public part of the attestation key in PEM, to verify\n"
+  "\tquotes with.\n"
+  "--nonce=HEX - qualifying data of the quote, up to 64 bytes. quotes are\n"
+  "\tverified against it if given.\n"
+  "--stats[=json] - print to stderr, as a table or json, the count, bytes\n"
+  "\tand min/p50/p99/max latency of every phase: opening and hashing\n"
+  "\tfiles, each kind of command to the tpm, logging of events, and\n"
+  "\toutput of values.\n"
   "Examples:\n"
   "read the value of pcr 12:\n"
   "\t%s read 12\n"
@@ -63,14 +181,79 @@ const char usagefmt[]
   "\t%s -a sha256 read 12\n"
   "extend the value of pcr 16 with files:\n"
   "\t%s extend 12 file1 <file2> ...\n"
+  "extend pcr 16 on both sha1 and sha256 banks (for TPM2 only):\n"
+  "\t%s -a sha1,sha256 extend 16 file1 <file2> ...\n"
+  "extend pcr 16 with an image while it is being downloaded:\n"
+  "\tcurl URL | %s extend --stream 16 > image\n"
+  "extend pcr 16 with the manifest of all files under /opt/app:\n"
+  "\t%s -j 8 --tree=/opt/app extend 16\n"
   "clear the value of pcr 17:\n"
   "\t%s clear 17\n"
+  "clear the values of pcr 16, 17 and 20 to 23:\n"
+  "\t%s clear 16,17,20-23\n"
   "clear the value of pcr 17 on sha256 bank (for TPM2 only):\n"
   "\t%s -a sha256 clear 17\n"
+  "compute the policy of pcr 0 and 7 on sha256 bank with predicted values:\n"
+  "\t%s -a sha256 policy sha256:000081 values1 <values2> ...\n"
   "enable pcr 3, 4 on sha256 bank, and pcr 17, 18 on sha384 bank (for TPM2 only):\n"
   "\t%s setalg sha256:000018+sha384:030000\n";
 
-const char optstr[] = "a:bo:";
+const char optstr[] = "a:bo:j:";
+
+enum {
+  OPT_IO_MODE = 0x100,
+  OPT_BUFFER_SIZE,
+  OPT_CACHE,
+  OPT_CACHE_VERIFY,
+  OPT_MEASURE,
+  OPT_MERKLE_BLOCK_SIZE,
+  OPT_MERKLE_SALT,
+  OPT_VERITY,
+  OPT_TREE,
+  OPT_TREE_MODE,
+  OPT_MANIFEST,
+  OPT_STREAM,
+  OPT_READBACK,
+  OPT_SOCKET,
+  OPT_TPM,
+  OPT_SOFT_STATE,
+  OPT_STATS,
+  OPT_PCR_CACHE,
+  OPT_INTERVAL,
+  OPT_AK,
+  OPT_AK_PUB,
+  OPT_NONCE,
+  OPT_TPM_TIMEOUT,
+  OPT_EVENT_LOG,
+};
+
+const struct option longopts[] = {
+  {"io-mode", required_argument, NULL, OPT_IO_MODE},
+  {"buffer-size", required_argument, NULL, OPT_BUFFER_SIZE},
+  {"cache", required_argument, NULL, OPT_CACHE},
+  {"cache-verify", required_argument, NULL, OPT_CACHE_VERIFY},
+  {"measure", required_argument, NULL, OPT_MEASURE},
+  {"merkle-block-size", required_argument, NULL, OPT_MERKLE_BLOCK_SIZE},
+  {"merkle-salt", required_argument, NULL, OPT_MERKLE_SALT},
+  {"verity", optional_argument, NULL, OPT_VERITY},
+  {"tree", required_argument, NULL, OPT_TREE},
+  {"tree-mode", required_argument, NULL, OPT_TREE_MODE},
+  {"manifest", required_argument, NULL, OPT_MANIFEST},
+  {"stream", no_argument, NULL, OPT_STREAM},
+  {"readback", required_argument, NULL, OPT_READBACK},
+  {"socket", required_argument, NULL, OPT_SOCKET},
+  {"tpm", required_argument, NULL, OPT_TPM},
+  {"soft-state", required_argument, NULL, OPT_SOFT_STATE},
+  {"stats", optional_argument, NULL, OPT_STATS},
+  {"pcr-cache", optional_argument, NULL, OPT_PCR_CACHE},
+  {"interval", required_argument, NULL, OPT_INTERVAL},
+  {"ak", required_argument, NULL, OPT_AK},
+  {"ak-pub", required_argument, NULL, OPT_AK_PUB},
+  {"nonce", required_argument, NULL, OPT_NONCE},
+  {"tpm-timeout", required_argument, NULL, OPT_TPM_TIMEOUT},
+  {"event-log", required_argument, NULL, OPT_EVENT_LOG},
+  {NULL, 0, NULL, 0}
+};
 
 extern const pcr_vtbl tpm12_pcr_vtbl;
 extern const pcr_vtbl tpm2_pcr_vtbl;
@@ -78,18 +261,92 @@ extern const pcr_vtbl tpm2_pcr_vtbl;
 int outputpcr(bool binary_out,
 	      FILE* fp,
 	      uint32_t pcr_index,
+	      const char* bank,
 	      const pcr* pcr_content)
 {
+  double start = stats_now();
+  int ret = 0;
+  size_t bytes = 0;
   if(pcr_content->s == 0) {
     fprintf(stderr,
 	    "Warning: pcr %u reports no value, which indicates "
 	    "hash algorithm mismatch when accessing tpm2.\n", pcr_index);
-    return 0;
+  } else if(binary_out) {
+    ret = fwrite(pcr_content->a, sizeof(pcr_content->a), 1, fp);
+    bytes = ret * sizeof(pcr_content->a);
+  } else {
+    ret = bank? fprintpcr_bank(fp, pcr_index, bank, pcr_content):
+      fprintpcr(fp, pcr_index, pcr_content);
+    bytes = (ret > 0)? ret: 0;
   }
-  if(binary_out)
-    return fwrite(pcr_content->a, sizeof(pcr_content->a), 1, fp);
-  else
-    return fprintpcr(fp, pcr_index, pcr_content);
+  stats_add(STATS_OUTPUT, start, bytes);
+  return ret;
+}
+
+/*
+ * parse a string of hex digits into buf.
+ * returns the number of bytes, or (size_t)-1 if s is malformed or too long.
+ */
+size_t parse_hex(const char* s, unsigned char* buf, size_t max)
+{
+  size_t n = 0;
+  size_t len = strlen(s);
+  if(len % 2 != 0 || len / 2 > max)
+    return (size_t)-1;
+  for(; n < len / 2; n++) {
+    if(sscanf(s + 2 * n, "%2hhx", &buf[n]) != 1)
+      return (size_t)-1;
+  }
+  return n;
+}
+
+/*
+ * split a comma-separated list of algorithms in place.
+ * returns the number of algorithms, or 0 if s is malformed.
+ */
+size_t split_alglist(char* s, const char** algs, size_t max)
+{
+  size_t n = 0;
+  char* save = NULL;
+  char* tok = strtok_r(s, ",", &save);
+  for(; tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    if(n == max)
+      return 0;
+    algs[n++] = tok;
+  }
+  return n;
+}
+
+/*
+ * parse "all", or a comma-separated list of pcr indexes and ranges such
+ * as "0,4,7-10", into a bitmap of pcrs.
+ */
+bool parse_pcrlist(const char* s, uint32_t* mask)
+{
+  *mask = 0;
+  if(0 == strcmp(s, "all")) {
+    *mask = (1u << PCR_NUM) - 1;
+    return true;
+  }
+  do {
+    char* end = NULL;
+    unsigned long first = strtoul(s, &end, 10);
+    unsigned long last = first;
+    if(end == s)
+      return false;
+    if(*end == '-') {
+      s = end + 1;
+      last = strtoul(s, &end, 10);
+      if(end == s)
+	return false;
+    }
+    if(first > last || last >= PCR_NUM)
+      return false;
+    for(; first <= last; first++)
+      *mask |= 1u << first;
+    s = end;
+  } while(*s++ == ',');
+  return *(s - 1) == '\0';
 }
 
 typedef struct farr {
@@ -120,7 +377,9 @@ farr* openfarr(int filec, const char** filev)
   {
     size_t i = 0;
     for(; i < filec; i++) {
+      double start = stats_now();
       FILE* fp = fopen(filev[i], "rb");
+      stats_add(STATS_OPEN, start, 0);
       if(fp == NULL) {
 	fprintf(stderr, "Fail to open the %zuth file %s:\n"
 		"%d: %s\n", i, filev[i], errno, strerror(errno));
@@ -134,15 +393,623 @@ farr* openfarr(int filec, const char** filev)
   return a;
 }
 
+enum {
+  VERITY_OFF = 0,
+  VERITY_MATCH,
+  VERITY_ANY,
+};
+
+/*
+ * Hash the files in a farr, or those of a mdtree, with a workq: each
+ * worker owns a MDSET, and digests of all files are collected into one
+ * array, in which digests of a file on every algorithm are stored one
+ * after another, starting at index * stride.
+ */
+typedef struct hashjob {
+  const farr* fa;
+  const mdtree* tree; // files are opened only while being hashed.
+  MDSET** s;
+  char* digests;
+  size_t stride;
+  size_t buff_size;
+  MDBIO_iomode iomode;
+  mdcache* cache;
+  double* busy; // seconds spent by each worker.
+  const char** names;
+  const char** algs;
+  const merkle_params* merkle; // NULL to digest files as streams.
+  size_t merkle_workers;
+  int verity;
+  size_t verity_files; // files measured with their fs-verity digests.
+} hashjob;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool hashjob_verity(hashjob* h, MDSET* s, FILE* f, char* md)
+{
+  char vd[EVP_MAX_MD_SIZE];
+  uint8_t valg = 0;
+  size_t vlen = merkle_measure_verity(f, &valg, vd, sizeof(vd));
+  size_t k = 0;
+
+  if(vlen == 0)
+    return false;
+  for(k = 0; k < s->num && h->verity == VERITY_MATCH; k++) {
+    if(merkle_alg_id(h->algs[k]) != valg)
+      return false;
+  }
+
+  for(k = 0; k < s->num; k++) {
+    size_t mdsize = MDSET_md_size(s, k);
+    if(merkle_alg_id(h->algs[k]) == valg && mdsize == vlen)
+      memcpy(md, vd, vlen);
+    else if(!EVP_Digest(vd, vlen, (unsigned char*)md, NULL, s->md[k], NULL))
+      return false;
+    md += mdsize;
+  }
+  __atomic_add_fetch(&h->verity_files, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+static FP_workq_job(hashjob_run)
+{
+  hashjob* h = (hashjob*)arg;
+  MDSET* s = h->s[worker];
+  char* md = h->digests + index * h->stride;
+  size_t len = 0;
+  double start = now();
+  double pstart = stats_now();
+  FILE* f = h->tree? mdtree_open(h->tree, index): h->fa->arr[index];
+  uint64_t bytes = s->bytes;
+  if(h->tree)
+    stats_add(STATS_OPEN, pstart, 0);
+  pstart = stats_now();
+
+  if(f == NULL) {
+    fprintf(stderr, "Fail to open the %zuth file %s:\n"
+	    "%d: %s\n", index, h->names[index], errno, strerror(errno));
+    return -(EXIT_FAILURE);
+  }
+
+  if(h->verity != VERITY_OFF && hashjob_verity(h, s, f, md)) {
+    len = h->stride;
+  } else if(h->merkle) {
+    size_t k = 0;
+    for(; k < s->num; k++) {
+      merkle_params p = *h->merkle;
+      merkle_info info;
+      size_t l = 0;
+      p.mdname = h->algs[k];
+      l = merkle_digest_file(&p, f, h->merkle_workers,
+			     md + len, h->stride - len, &info);
+      if(l == 0)
+	break;
+      len += l;
+      s->bytes += info.data_size; // read by merkle workers, not by s.
+      merkle_report(&p, &info, h->names[index], stderr);
+    }
+  } else {
+    len = h->cache?
+      mdcache_digest_file(h->cache, s, f,
+			  h->buff_size, h->iomode, md, h->stride):
+      MDSET_digest_file(s, f, h->buff_size, h->iomode, md, h->stride);
+    if(len != h->stride)
+      fprintf(stderr, "Fail to read the %zuth file %s:\n"
+	      "%d: %s\n", index, h->names[index], errno, strerror(errno));
+  }
+  stats_add(STATS_HASH, pstart, s->bytes - bytes);
+  if(h->tree)
+    fclose(f);
+  h->busy[worker] += now() - start;
+  return (len == h->stride)? 0: -(EXIT_FAILURE);
+}
+
+/*
+ * extend a pcr on every bank selected with one command per file (or
+ * manifest), with digests on each algorithm stored one after another.
+ * new values are read back after every extend (READBACK_EACH), once
+ * after all of them (READBACK_FINAL), or predicted in software from a
+ * read before all of them, and checked by the read after (READBACK_VERIFY).
+ * without a read after every extend, extends are sent without waiting for
+ * the previous one to complete, to hash the next file meanwhile.
+ */
+enum {
+  READBACK_EACH = 0,
+  READBACK_FINAL,
+  READBACK_VERIFY,
+};
+
+typedef struct extendjob {
+  pcr_context_base* ctx;
+  uint32_t pcr_index;
+  const char* const* algs;
+  size_t nalg;
+  int readback;
+  uint32_t ids[MDSET_MAX];
+  pcr value[MDSET_MAX];
+  pcr expect[MDSET_MAX];
+  size_t count; // of extends done.
+  eventlog* log; // of extends, if not NULL.
+} extendjob;
+
+static uint32_t extendjob_read(extendjob* e, pcr* value)
+{
+  pcr values[e->nalg * PCR_NUM];
+  size_t k = 0;
+  uint32_t ret = tpm_errout(e->ctx, "read pcr values...\n",
+			    tpm_pcr_read_multi(e->ctx, e->ids, e->nalg,
+					       1u << e->pcr_index, values));
+  for(; k < e->nalg && ret == 0; k++)
+    value[k] = values[k * PCR_NUM + e->pcr_index];
+  return ret;
+}
+
+static uint32_t extendjob_begin(extendjob* e, pcr_context_base* ctx,
+				uint32_t pcr_index,
+				const tpm2_hashalg_list_item* const* ialgs,
+				const char* const* algs, size_t nalg,
+				int readback, eventlog* log)
+{
+  size_t k = 0;
+  *e = (extendjob){ctx, pcr_index, algs, nalg, readback};
+  e->log = log;
+  for(; k < nalg; k++)
+    e->ids[k] = ialgs[k]? ialgs[k]->id: 0;
+  if(readback == READBACK_VERIFY)
+    return extendjob_read(e, e->expect);
+  return 0;
+}
+
+// what is measured, a path, goes to the event log before the extend.
+static uint32_t extendjob_extend(extendjob* e, const char* md,
+				 const size_t* mdsize, const char* what)
+{
+  uint32_t lens[e->nalg];
+  size_t k = 0;
+  for(; k < e->nalg; k++)
+    lens[k] = mdsize[k];
+  if(e->log) {
+    double start = stats_now();
+    bool logged = eventlog_append(e->log, e->pcr_index, EVENTLOG_EV_IPL,
+				  md, what, strlen(what));
+    stats_add(STATS_EVENTLOG, start, 0);
+    if(!logged) {
+      fprintf(stderr, "Error: Unable to log the extend of %s: %s\n",
+	      what, strerror(errno));
+      return -(EXIT_FAILURE);
+    }
+  }
+  uint32_t ret = tpm_errout(e->ctx, "extend pcr value...\n",
+			    (e->readback == READBACK_EACH)?
+			    tpm_pcr_extend_multi(e->ctx, e->pcr_index,
+						 e->ids, e->nalg, md, lens,
+						 e->value):
+			    tpm_pcr_extend_async(e->ctx, e->pcr_index,
+						 e->ids, e->nalg, md, lens));
+  if(ret != 0)
+    return ret;
+  e->count ++;
+  if(e->readback == READBACK_VERIFY) {
+    for(k = 0; k < e->nalg; md += mdsize[k], k++) {
+      pcr* v = &e->expect[k];
+      // banks not allocated report no value, and ignore extends as well.
+      if(v->s != 0 && MD_extend(e->algs[k], v->a, v->s, md, mdsize[k]) == 0)
+	return -(EXIT_FAILURE);
+    }
+  }
+  return 0;
+}
+
+static uint32_t extendjob_end(extendjob* e)
+{
+  uint32_t ret = 0;
+  size_t k = 0;
+  if(e->readback == READBACK_EACH || e->count == 0)
+    return 0;
+  ret = tpm_errout(e->ctx, "extend pcr value...\n", tpm_pcr_finish(e->ctx));
+  if(ret == 0)
+    ret = extendjob_read(e, e->value);
+  for(; k < e->nalg && ret == 0 && e->readback == READBACK_VERIFY; k++) {
+    if(e->value[k].s != e->expect[k].s
+       || 0 != memcmp(e->value[k].a, e->expect[k].a, e->value[k].s)) {
+      fprintf(stderr,
+	      "Error: pcr %u on %s is not the value expected, "
+	      "it has been extended by others meanwhile!\n",
+	      e->pcr_index, e->algs[k]);
+      ret = -(EXIT_FAILURE);
+    }
+  }
+  return ret;
+}
+
+static volatile sig_atomic_t watch_stopped = 0;
+
+static void watch_stop(int sig)
+{
+  watch_stopped = 1;
+}
+
+/*
+ * print the pcrs of pcr_mask on every bank, then those changed since the
+ * poll before, every interval_ms. with pcrUpdateCounter, pcrs are read
+ * only when it moves, but for the ones it does not count.
+ */
+static uint32_t watch_pcrs(pcr_context_base* ctx, const uint32_t* ids,
+			   const char* const* algs, size_t nalg,
+			   uint32_t pcr_mask, unsigned interval_ms,
+			   bool binout, FILE* fpout)
+{
+  pcr last[nalg * PCR_NUM];
+  pcr cur[nalg * PCR_NUM];
+  bool counted = tpm_has_update_counter(ctx);
+  bool first = true;
+  uint32_t counter = 0;
+  uint32_t ret = 0;
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = watch_stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  while(!watch_stopped) {
+    uint32_t poll = pcr_mask;
+    size_t k = 0;
+    if(counted && !first) {
+      uint32_t now = 0;
+      ret = tpm_pcr_read_counter(ctx, NULL, 0, 0, NULL, &now);
+      if(ret != 0)
+	break;
+      if(now == counter)
+	poll &= PCR_UNCOUNTED;
+    }
+
+    if(poll != 0) {
+      ret = counted?
+	tpm_pcr_read_counter(ctx, ids, nalg, poll, cur, &counter):
+	tpm_pcr_read_multi(ctx, ids, nalg, poll, cur);
+      if(ret != 0)
+	break;
+    }
+    for(; k < nalg && poll != 0; k++) {
+      uint32_t i = 0;
+      for(; i < PCR_NUM; i++) {
+	pcr* v = &cur[k * PCR_NUM + i];
+	pcr* l = &last[k * PCR_NUM + i];
+	if(!(poll & (1u << i)))
+	  continue;
+	if(first || v->s != l->s || 0 != memcmp(v->a, l->a, v->s)) {
+	  outputpcr(binout, fpout, i, (nalg > 1)? algs[k]: NULL, v);
+	  *l = *v;
+	}
+      }
+    }
+    fflush(fpout);
+    first = false;
+
+    {
+      // cut short by the signals, which are not restarted.
+      struct timespec ts = {interval_ms / 1000,
+			    (interval_ms % 1000) * 1000000L};
+      nanosleep(&ts, NULL);
+    }
+  }
+  return ret;
+}
+
+/*
+ * quote the pcrs of pcr_mask on every bank, and save the quote with the
+ * values quoted. with pcrUpdateCounter, the values are read again if it
+ * moved across the quote, so the ones saved are the ones quoted. pcrs it
+ * may not count (PCR_UNCOUNTED), or a tpm without it, are caught by
+ * checking the values against pcrDigest of the attest.
+ */
+static uint32_t quote_pcrs(pcr_context_base* ctx, const uint32_t* ids,
+			   size_t nalg, uint32_t pcr_mask, uint32_t ak,
+			   const char* nonce, size_t nonce_len, FILE* fpout)
+{
+  quote_file* f = calloc(1, sizeof(*f));
+  bool counted = tpm_has_update_counter(ctx);
+  uint32_t ret = 0;
+  int tries = 0;
+  const char* why = NULL;
+  if(f == NULL)
+    return -(EXIT_FAILURE);
+
+  f->nalg = nalg;
+  f->pcr_mask = pcr_mask;
+  memcpy(f->algs, ids, nalg * sizeof(*ids));
+  for(; tries < 3; tries++) {
+    uint32_t before = 0;
+    uint32_t after = 0;
+    ret = counted?
+      tpm_pcr_read_counter(ctx, ids, nalg, pcr_mask, f->values, &before):
+      tpm_pcr_read_multi(ctx, ids, nalg, pcr_mask, f->values);
+    if(ret == 0)
+      ret = tpm_pcr_quote(ctx, ak, ids, nalg, pcr_mask,
+			  nonce, nonce_len, &f->q);
+    if(ret == 0 && counted)
+      ret = tpm_pcr_read_counter(ctx, NULL, 0, 0, NULL, &after);
+    if(ret != 0)
+      break;
+    why = (before == after)? quote_check_values(f): "pcrUpdateCounter moved";
+    if(why == NULL)
+      break;
+  }
+  if(ret == 0 && tries == 3) {
+    fprintf(stderr, "pcrs kept changing while being quoted (%s)!\n", why);
+    ret = -(EXIT_FAILURE);
+  }
+  if(ret == 0 && quote_fprint(fpout, f) != 0)
+    ret = -(EXIT_FAILURE);
+  free(f);
+  return ret;
+}
+
+typedef struct verifyjob {
+  char** files;
+  EVP_PKEY* ak;
+  const char* nonce;
+  size_t nonce_len;
+  const char** why; // of each file, NULL if verified.
+} verifyjob;
+
+static FP_workq_job(verifyjob_run)
+{
+  verifyjob* v = (verifyjob*)arg;
+  quote_file* f = malloc(sizeof(*f));
+  if(f == NULL) {
+    v->why[index] = "out of memory";
+  } else if(!quote_load(v->files[index], f)) {
+    v->why[index] = "unable to load quote";
+  } else {
+    v->why[index] = quote_verify(f, v->ak, v->nonce, v->nonce_len);
+  }
+  free(f);
+  return 0;
+}
+
+/*
+ * verify quotes in files with the public key in akpub, on up to jobs
+ * threads. no tpm is needed.
+ */
+static int verify_quotes(char** files, size_t num, const char* akpub,
+			 const char* nonce, size_t nonce_len, size_t jobs,
+			 FILE* fpout)
+{
+  verifyjob v = {files, NULL, nonce, nonce_len, NULL};
+  workq* q = NULL;
+  size_t failed = 0;
+  size_t i = 0;
+  double start = now();
+  double secs = 0;
+  FILE* fp = NULL;
+  int ret = 0;
+
+  if(!OSSL_init()) {
+    fputs("Error: Unable to init OpenSSL Library!\n",stderr);
+    return -(EXIT_FAILURE);
+  }
+  do {
+    fp = fopen(akpub, "r");
+    if(fp == NULL || (v.ak = PEM_read_PUBKEY(fp, NULL, NULL, NULL)) == NULL) {
+      fprintf(stderr, "unable to load public key from %s!\n", akpub);
+      ret = -(EXIT_FAILURE);
+      break;
+    }
+    v.why = calloc(num, sizeof(*v.why));
+    q = v.why? workq_new(jobs > num? num: jobs, num, verifyjob_run, &v): NULL;
+    if(q == NULL) {
+      fputs("Fail to start verifying quotes!\n", stderr);
+      ret = -(EXIT_FAILURE);
+      break;
+    }
+    for(; i < num; i++) {
+      workq_wait(q, i);
+      if(v.why[i] == NULL) {
+	fprintf(fpout, "%s: OK\n", files[i]);
+      } else {
+	fprintf(fpout, "%s: FAILED (%s)\n", files[i], v.why[i]);
+	failed ++;
+      }
+    }
+    secs = now() - start;
+    fprintf(stderr, "verified %zu quote(s) in %.3fs, %.1f/s, %zu failed.\n",
+	    num, secs, (secs > 0)? num / secs: 0.0, failed);
+    if(failed)
+      ret = -(EXIT_FAILURE);
+  } while(0);
+
+  if(q)
+    workq_free(q);
+  free(v.why);
+  EVP_PKEY_free(v.ak);
+  if(fp)
+    fclose(fp);
+  OSSL_uninit();
+  return ret;
+}
+
+typedef struct policyjob {
+  char** files;
+  const EVP_MD* md;
+  const void* selection;
+  char* digests; // EVP_MAX_MD_SIZE for each file.
+  const char** why; // of each file, NULL if done.
+} policyjob;
+
+static FP_workq_job(policyjob_run)
+{
+  policyjob* p = (policyjob*)arg;
+  policy_pcrs* v = malloc(sizeof(*v));
+  if(v == NULL) {
+    p->why[index] = "out of memory";
+  } else {
+    p->why[index] = policy_load(p->files[index], v);
+    if(p->why[index] == NULL)
+      p->why[index] = policy_pcr_digest(p->md, p->selection, v,
+					p->digests + index * EVP_MAX_MD_SIZE);
+  }
+  free(v);
+  return 0;
+}
+
+/*
+ * print the PolicyPCR digest in alg over selection of each file of
+ * predicted values, in the format of sha1sum, on up to jobs threads.
+ * no tpm is needed.
+ */
+static int policy_digests(char** files, size_t num, const char* alg,
+			  const char* selection, size_t jobs, FILE* fpout)
+{
+  policyjob p = {files, NULL, NULL, NULL, NULL};
+  void* sel = NULL;
+  size_t count = 0;
+  workq* q = NULL;
+  size_t failed = 0;
+  size_t i = 0;
+  double start = now();
+  double secs = 0;
+  int ret = 0;
+
+  if(!OSSL_init()) {
+    fputs("Error: Unable to init OpenSSL Library!\n",stderr);
+    return -(EXIT_FAILURE);
+  }
+  do {
+    p.md = EVP_get_digestbyname(alg);
+    if(p.md == NULL || MD_tpm2_checksupport(alg) == NULL) {
+      fprintf(stderr, "TPM2 cannot process the digest of %s!\n", alg);
+      ret = -(EXIT_FAILURE);
+      break;
+    }
+    if(!parse_selection(selection, &count, &sel)) {
+      fputs("Failed to pass config bitmap!\n", stderr);
+      ret = -(EXIT_FAILURE);
+      break;
+    }
+    p.selection = sel;
+    p.digests = malloc(num * EVP_MAX_MD_SIZE);
+    p.why = calloc(num, sizeof(*p.why));
+    if(p.digests && p.why)
+      q = workq_new(jobs > num? num: jobs, num, policyjob_run, &p);
+    if(q == NULL) {
+      fputs("Fail to start computing policies!\n", stderr);
+      ret = -(EXIT_FAILURE);
+      break;
+    }
+    for(; i < num; i++) {
+      workq_wait(q, i);
+      if(p.why[i] == NULL) {
+	const char* d = p.digests + i * EVP_MAX_MD_SIZE;
+	int j = 0;
+	for(; j < EVP_MD_size(p.md); j++)
+	  fprintf(fpout, "%02hhx", d[j]);
+	fprintf(fpout, "  %s\n", files[i]);
+      } else {
+	fprintf(stderr, "%s: %s!\n", files[i], p.why[i]);
+	failed ++;
+      }
+    }
+    secs = now() - start;
+    fprintf(stderr, "computed %zu policy digest(s) in %.3fs, %.1f/s, "
+	    "%zu failed.\n", num - failed, secs,
+	    (secs > 0)? num / secs: 0.0, failed);
+    if(failed)
+      ret = -(EXIT_FAILURE);
+  } while(0);
+
+  if(q)
+    workq_free(q);
+  free(p.why);
+  free(p.digests);
+  free(sel);
+  OSSL_uninit();
+  return ret;
+}
+
+/*
+ * extend a pcr with everything passed from stdin to stdout, once stdin
+ * reaches EOF; nothing is extended if the stream breaks.
+ */
+static uint32_t extend_stream(extendjob* e, size_t buff_size)
+{
+  uint32_t ret = 0;
+  MDSET* s = MDSET_new(e->algs, e->nalg);
+  if(s == NULL) {
+    fprintf(stderr, "Error: Unable to create MDSET: %s\n",
+	    ERR_error_string(ERR_get_error(), NULL));
+    return -(EXIT_FAILURE);
+  }
+
+  double start = now();
+  double pstart = stats_now();
+  ssize_t len = MDSET_feed_stream(s, STDIN_FILENO, STDOUT_FILENO, buff_size);
+  double secs = now() - start;
+  stats_add(STATS_HASH, pstart, s->bytes);
+  if(len < 0) {
+    fprintf(stderr, "Error: stream broken after %llu byte(s): %s\n",
+	    (unsigned long long)s->bytes, strerror(errno));
+    ret = -(EXIT_FAILURE);
+  } else {
+    char md[EVP_MAX_MD_SIZE * MDSET_MAX];
+    size_t mdsize[MDSET_MAX];
+    size_t k = 0;
+    for(; k < e->nalg; k++)
+      mdsize[k] = MDSET_md_size(s, k);
+    if(MDSET_getmds(s, md, sizeof(md)) == 0)
+      ret = -(EXIT_FAILURE);
+    else
+      ret = extendjob_extend(e, md, mdsize, "-");
+    fprintf(stderr, "streamed %zd byte(s) in %.3fs, %.1f MB/s.\n",
+	    len, secs, (secs > 0)? len / secs / 1e6: 0.0);
+  }
+  MDSET_free(s);
+  return ret;
+}
+
 int main(int argc, char** argv)
 {
   const char* alg = "sha1";
-  const tpm2_hashalg_list_item* ialg = NULL;
+  const char* algs[MDSET_MAX] = {NULL};
+  const tpm2_hashalg_list_item* ialgs[MDSET_MAX] = {NULL};
+  size_t nalg = 0;
+  const char* badalg = NULL;
   bool binout = false;
   const char* outfile = NULL;
   const char* command = NULL;
   uint32_t pcr_index = 24;//for "all pcrs".
+  uint32_t pcr_mask = 0;
   const char* cfgmap = NULL;
+  MDBIO_iomode iomode = MDBIO_IO_READ;
+  size_t buff_size = MDBIO_DEFAULT_BUFF_SIZE;
+  size_t jobs = 1;
+  const char* pcrcachefile = NULL;
+  const char* eventlogfile = NULL;
+  unsigned interval = 2000;
+  uint32_t ak = 0;
+  const char* akpub = NULL;
+  unsigned char nonce[64];
+  size_t nonce_len = (size_t)-1; // none given.
+  const char* cachefile = NULL;
+  unsigned int cache_verify = 0;
+  bool measure_merkle = false;
+  int verity = VERITY_OFF;
+  const char* treedir = NULL;
+  bool tree_manifest = true;
+  const char* manifestfile = NULL;
+  bool stream = false;
+  int readback = READBACK_EACH;
+  const char* socketpath = NULL;
+  tpmdetect_result tpmsel = TPMDETECT_NONE; // for auto.
+  bool soft = false;
+  bool stats_json = false;
+  merkle_params merkle = (merkle_params){NULL, MERKLE_DEFAULT_BLOCK_SIZE, 0, {0}};
 
   if (argc == 1) {
     fprintf(stderr,
@@ -153,6 +1020,11 @@ int main(int argc, char** argv)
 	    argv[0],
 	    argv[0],
 	    argv[0],
+	    argv[0],
+	    argv[0],
+	    argv[0],
+	    argv[0],
+	    argv[0],
 	    argv[0]);
     return 0;
   }
@@ -160,9 +1032,9 @@ int main(int argc, char** argv)
   // parse options.
   {
     int opt = 0;
-    for(opt = getopt(argc, argv, optstr);
+    for(opt = getopt_long(argc, argv, optstr, longopts, NULL);
 	opt != -1;
-	opt = getopt(argc, argv, optstr)) {
+	opt = getopt_long(argc, argv, optstr, longopts, NULL)) {
       switch(opt) {
       case 'a':
 	alg = optarg;
@@ -173,9 +1045,203 @@ int main(int argc, char** argv)
       case 'o':
 	outfile = optarg;
 	break;
+      case 'j':
+	jobs = strtoul(optarg, NULL, 0);
+	if(jobs == 0) {
+	  fprintf(stderr, "Invalid number of jobs %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_IO_MODE:
+	if(!MDBIO_iomode_byname(optarg, &iomode)) {
+	  fprintf(stderr, "Unknown io mode %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_BUFFER_SIZE:
+	if(!MD_parse_size(optarg, &buff_size)) {
+	  fprintf(stderr, "Invalid buffer size %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_CACHE:
+	cachefile = optarg;
+	break;
+      case OPT_CACHE_VERIFY:
+	{
+	  char* end = NULL;
+	  unsigned long pct = strtoul(optarg, &end, 10);
+	  if(*optarg == '\0' || *end != '\0' || strchr(optarg, '-') != NULL
+	     || pct > 100) {
+	    fprintf(stderr, "Invalid percentage %s!\n", optarg);
+	    return -(EXIT_FAILURE);
+	  }
+	  cache_verify = pct;
+	}
+	break;
+      case OPT_MEASURE:
+	if(0 == strcmp(optarg, "merkle")) {
+	  measure_merkle = true;
+	} else if(0 == strcmp(optarg, "stream")) {
+	  measure_merkle = false;
+	} else {
+	  fprintf(stderr, "Unknown measurement %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_MERKLE_BLOCK_SIZE:
+	if(!MD_parse_size(optarg, &merkle.block_size)) {
+	  fprintf(stderr, "Invalid block size %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_MERKLE_SALT:
+	merkle.salt_size = parse_hex(optarg, merkle.salt, sizeof(merkle.salt));
+	if(merkle.salt_size == (size_t)-1) {
+	  fprintf(stderr, "Invalid salt %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_VERITY:
+	if(optarg == NULL || 0 == strcmp(optarg, "match")) {
+	  verity = VERITY_MATCH;
+	} else if(0 == strcmp(optarg, "any")) {
+	  verity = VERITY_ANY;
+	} else {
+	  fprintf(stderr, "Unknown fs-verity mode %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_TREE:
+	treedir = optarg;
+	break;
+      case OPT_TREE_MODE:
+	if(0 == strcmp(optarg, "manifest")) {
+	  tree_manifest = true;
+	} else if(0 == strcmp(optarg, "files")) {
+	  tree_manifest = false;
+	} else {
+	  fprintf(stderr, "Unknown tree mode %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_MANIFEST:
+	manifestfile = optarg;
+	break;
+      case OPT_STREAM:
+	stream = true;
+	break;
+      case OPT_PCR_CACHE:
+	pcrcachefile = optarg? optarg: PCRCACHE_DEFAULT;
+	break;
+      case OPT_INTERVAL:
+	{
+	  char* end = NULL;
+	  unsigned long ms = strtoul(optarg, &end, 10);
+	  if(*optarg == '\0' || *end != '\0' || ms == 0 || ms > 86400000) {
+	    fprintf(stderr, "Invalid interval %s!\n", optarg);
+	    return -(EXIT_FAILURE);
+	  }
+	  interval = ms;
+	}
+	break;
+      case OPT_AK:
+	{
+	  char* end = NULL;
+	  ak = strtoul(optarg, &end, 0);
+	  if(*optarg == '\0' || *end != '\0' || ak == 0) {
+	    fprintf(stderr, "Invalid key handle %s!\n", optarg);
+	    return -(EXIT_FAILURE);
+	  }
+	}
+	break;
+      case OPT_AK_PUB:
+	akpub = optarg;
+	break;
+      case OPT_NONCE:
+	nonce_len = parse_hex(optarg, nonce, sizeof(nonce));
+	if(nonce_len == (size_t)-1) {
+	  fprintf(stderr, "Invalid nonce %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_STATS:
+	if(optarg && 0 != strcmp(optarg, "json")) {
+	  fprintf(stderr, "Unknown stats format %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	stats_json = (optarg != NULL);
+	stats_enable();
+	break;
+      case OPT_TPM:
+	if(0 == strcmp(optarg, "1.2")) {
+	  tpmsel = TPMDETECT_TPM12;
+	} else if(0 == strcmp(optarg, "2")) {
+	  tpmsel = TPMDETECT_TPM2;
+	} else if(0 == strcmp(optarg, "auto")) {
+	  tpmsel = TPMDETECT_NONE;
+	} else if(0 == strcmp(optarg, "soft")) {
+	  soft = true;
+	} else {
+	  fprintf(stderr, "Unknown tpm version %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
+      case OPT_EVENT_LOG:
+	eventlogfile = optarg;
+	break;
+      case OPT_TPM_TIMEOUT:
+	{
+	  char* end = NULL;
+	  unsigned long ms = strtoul(optarg, &end, 10);
+	  if(*optarg == '\0' || *end != '\0' || ms > 86400000) {
+	    fprintf(stderr, "Invalid timeout %s!\n", optarg);
+	    return -(EXIT_FAILURE);
+	  }
+	  tpm12_set_timeout(ms);
+	}
+	break;
+      case OPT_SOFT_STATE:
+	softtpm_set_state(optarg);
+	break;
+      case OPT_SOCKET:
+	socketpath = optarg;
+	break;
+      case OPT_READBACK:
+	if(0 == strcmp(optarg, "each")) {
+	  readback = READBACK_EACH;
+	} else if(0 == strcmp(optarg, "final")) {
+	  readback = READBACK_FINAL;
+	} else if(0 == strcmp(optarg, "verify")) {
+	  readback = READBACK_VERIFY;
+	} else {
+	  fprintf(stderr, "Unknown readback mode %s!\n", optarg);
+	  return -(EXIT_FAILURE);
+	}
+	break;
       default: // '?' 
 	fprintf(stderr, usagefmt,
-		argv[0]);
+		argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+		argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+	return -(EXIT_FAILURE);
+      }
+    }
+  }
+
+  char algbuf[strlen(alg) + 1];
+  nalg = split_alglist(strcpy(algbuf, alg), algs, MDSET_MAX);
+  if(nalg == 0) {
+    fprintf(stderr, "Invalid list of algorithms %s!\n", alg);
+    return -(EXIT_FAILURE);
+  }
+  if(measure_merkle) {
+    size_t i = 0;
+    for(; i < nalg; i++) {
+      merkle.mdname = algs[i];
+      if(!merkle_params_check(&merkle)) {
+	fprintf(stderr,
+		"Merkle tree of %s with block size %zu is not supported!\n",
+		algs[i], merkle.block_size);
 	return -(EXIT_FAILURE);
       }
     }
@@ -184,6 +1250,8 @@ int main(int argc, char** argv)
   FILE* fpout = NULL;
   if(outfile)
     fpout = fopen(outfile, "wb");
+  else if(stream) // stdout carries the data passed through.
+    fpout = stderr;
   else
     fpout = stdout;
 
@@ -196,17 +1264,55 @@ int main(int argc, char** argv)
     
 
   command = argv[optind];
-  if(argv[optind + 1] == NULL) {
+  bool serving = (0 == strcmp(command, "daemon"));
+  if(argv[optind + 1] == NULL && !serving) {
     fputs("Missing operand!\n", stderr);
     return -(EXIT_FAILURE);
   }
   
-  if(0 != strcmp(command, "setalg")){
-    pcr_index = atoi(argv[optind + 1]);
-    
-    if((pcr_index < 0)||
-       (pcr_index > 23)) {
-      fprintf(stderr, "PCR index %d is invalid!\n", pcr_index);
+  if(0 == strcmp(command, "verify-quote")) {
+    // offline, with no tpm to set up.
+    int failed = -(EXIT_FAILURE);
+    if(akpub == NULL)
+      fputs("verify-quote needs --ak-pub!\n", stderr);
+    else
+      failed = verify_quotes(argv + optind + 1, argc - optind - 1, akpub,
+			     (nonce_len != (size_t)-1)? (char*)nonce: NULL,
+			     (nonce_len != (size_t)-1)? nonce_len: 0,
+			     jobs, fpout);
+    if (fpout != stdout && fpout != stderr)
+      fclose(fpout);
+    return failed;
+  }
+
+  if(0 == strcmp(command, "policy")) {
+    // offline too.
+    int failed = -(EXIT_FAILURE);
+    if(nalg > 1)
+      fputs("policy takes only one algorithm!\n", stderr);
+    else if(argv[optind + 2] == NULL)
+      fputs("Missing files of pcr values!\n", stderr);
+    else
+      failed = policy_digests(argv + optind + 2, argc - optind - 2, algs[0],
+			      argv[optind + 1], jobs, fpout);
+    if (fpout != stdout && fpout != stderr)
+      fclose(fpout);
+    return failed;
+  }
+
+  if(serving) {
+    // the daemon serves any pcr, and takes no operand.
+  } else if(0 != strcmp(command, "setalg")){
+    if(!parse_pcrlist(argv[optind + 1], &pcr_mask)) {
+      fprintf(stderr, "PCR index %s is invalid!\n", argv[optind + 1]);
+      return -(EXIT_FAILURE);
+    }
+    // only read, watch, quote and clear take more than one pcr.
+    if((pcr_mask & (pcr_mask - 1)) == 0)
+      pcr_index = __builtin_ctz(pcr_mask);
+    else if(0 != strcmp(command, "read") && 0 != strcmp(command, "watch")
+	    && 0 != strcmp(command, "quote") && 0 != strcmp(command, "clear")) {
+      fprintf(stderr, "Command %s takes only one PCR!\n", command);
       return -(EXIT_FAILURE);
     }
   } else {
@@ -216,54 +1322,197 @@ int main(int argc, char** argv)
   const pcr_vtbl* t = &tpm12_pcr_vtbl;
   pcr_context_base ctx = (pcr_context_base){NULL, {{0, 0}}};
   int ret = 0;
+  bool tpm1 = false;
+  double init_start = stats_now();
 
-  {
-    fputs("Trying to access TPM v1...\n", stderr);
+  if(socketpath && !serving) {
+    t = &pcrd_client_vtbl;
+    pcrd_set_socket(socketpath);
     ret = tpm_ctx_init(&ctx, t);
-    if (0 == ret) {
-      fputs("Successful to get access to a tpm1, going ahead...\n", stderr);
-    } else {
+    if(0 != ret) {
       tpm_ctx_uninit(&ctx);
       fprintf(stderr,
-	      "0x%x: Unable to get access to a tpm1, try tpm2 instead...\n",
-	      ret);
-      t = &tpm2_pcr_vtbl;
+	      "0x%x: Unable to reach pcrtool daemon at %s, exiting.\n",
+	      ret, socketpath);
+      return ret;
+    }
+    tpm1 = (0 == strcmp(pcrd_remote_version(), tpm12_pcr_vtbl.tpm_version));
+    fprintf(stderr, "Connected to pcrtool daemon on a tpm%s, going ahead...\n",
+	    pcrd_remote_version());
+  } else if(soft) {
+    t = &softtpm_pcr_vtbl;
+    ret = tpm_ctx_init(&ctx, t);
+    if(0 != ret) {
+      tpm_errout(&ctx, "Unable to start the soft tpm, exiting...\n", ret);
+      tpm_ctx_uninit(&ctx);
+      return ret;
+    }
+  } else {
+    double start = now();
+    double probe = 0;
+    const char* how = "--tpm";
+    tpmdetect_result found = tpmsel;
+    bool tpm1_timedout = false; // not to wait for it again.
+    if(found == TPMDETECT_NONE) {
+      how = "cache";
+      found = tpmdetect_cached(TPMDETECT_CACHE);
+    }
+    if(found == TPMDETECT_NONE) {
+      how = "sysfs";
+      found = tpmdetect_sysfs();
+    }
+
+    if(found != TPMDETECT_NONE) {
+      t = (found == TPMDETECT_TPM2)? &tpm2_pcr_vtbl: &tpm12_pcr_vtbl;
+      probe = now();
       ret = tpm_ctx_init(&ctx, t);
-      if (0 == ret) {
-	fputs("Successful to get access to a tpm2, going ahead...\n", stderr);
-	ialg = MD_tpm2_checksupport(alg);
-	if(ialg != NULL) {
-	  tpm_ctx_setalg(&ctx, ialg->id);
-	} else {
-	  alg = NULL;
-	  
+      probe = now() - probe;
+      if(0 != ret) {
+	tpm_ctx_uninit(&ctx);
+	if(tpmsel != TPMDETECT_NONE) {
+	  fprintf(stderr,
+		  "0x%x: Unable to get access to a tpm%s in %.3fms, exiting.\n",
+		  ret, t->tpm_version, probe * 1e3);
+	  return ret;
 	}
+	fprintf(stderr,
+		"0x%x: Unable to get access to the tpm%s found by %s "
+		"in %.3fms, probing instead...\n",
+		ret, t->tpm_version, how, probe * 1e3);
+	tpm1_timedout = (t == &tpm12_pcr_vtbl && ret == TPM12_E_TIMEOUT);
+	found = TPMDETECT_NONE;
+	t = &tpm12_pcr_vtbl;
+      }
+    }
+
+    if(found == TPMDETECT_NONE) {
+      how = "probing";
+      if(tpm1_timedout) {
+	ret = TPM12_E_TIMEOUT;
       } else {
+	fputs("Trying to access TPM v1...\n", stderr);
+	probe = now();
+	ret = tpm_ctx_init(&ctx, t);
+	probe = now() - probe;
+      }
+      if (0 == ret) {
+	fputs("Successful to get access to a tpm1, going ahead...\n", stderr);
+      } else {
+	if(!tpm1_timedout)
+	  tpm_ctx_uninit(&ctx);
 	fprintf(stderr,
-		"0x%x: Unable to find any supported tpms, exiting.\n",
-		ret);
-	return ret;
+		"0x%x: Unable to get access to a tpm1 in %.3fms, "
+		"try tpm2 instead...\n", ret, probe * 1e3);
+	t = &tpm2_pcr_vtbl;
+	ret = tpm_ctx_init(&ctx, t);
+	if (0 == ret) {
+	  fputs("Successful to get access to a tpm2, going ahead...\n", stderr);
+	} else {
+	  fprintf(stderr,
+		  "0x%x: Unable to find any supported tpms, exiting.\n",
+		  ret);
+	  return ret;
+	}
       }
     }
+    tpm1 = (t == &tpm12_pcr_vtbl);
+    fprintf(stderr, "Found tpm%s by %s in %.3fms, going ahead...\n",
+	    t->tpm_version, how, (now() - start) * 1e3);
+    // for the next runs to go straight to it.
+    if(tpmsel == TPMDETECT_NONE && 0 != strcmp(how, "cache"))
+      tpmdetect_save(TPMDETECT_CACHE,
+		     tpm1? TPMDETECT_TPM12: TPMDETECT_TPM2);
+  }
+  // timed as a whole, with probes of tpms not found.
+  stats_add(STATS_TPM_INIT, init_start, 0);
+  if(stats_enabled())
+    ctx.vtbl = stats_vtbl(ctx.vtbl);
+
+  if(!tpm1) {
+    size_t i = 0;
+    for(; i < nalg; i++) {
+      ialgs[i] = MD_tpm2_checksupport(algs[i]);
+      if(ialgs[i] == NULL && badalg == NULL)
+	badalg = algs[i];
+    }
+    if(ialgs[0] != NULL)
+      tpm_ctx_setalg(&ctx, ialgs[0]->id);
   }
   
   do {
-    if(0 == strcmp("read", command)) {
+    bool watching = (0 == strcmp("watch", command));
+    if((0 == strcmp("read", command)
+	&& (pcr_index == 24 || nalg > 1 || pcrcachefile)) || watching) {
+      if(badalg != NULL) {
+	fprintf(stderr, "TPM2 cannot process the digest of %s!\n", badalg);
+	ret = -(EXIT_FAILURE);
+	break;
+      }
+      if(tpm1 && nalg > 1) {
+	fputs("TPM1 has only one bank of pcrs!\n", stderr);
+	ret = -(EXIT_FAILURE);
+	break;
+      }
+      uint32_t ids[nalg];
+      pcr values[nalg * PCR_NUM];
+      size_t k = 0;
+      for(; k < nalg; k++)
+	ids[k] = ialgs[k]? ialgs[k]->id: 0;
+      if(watching) {
+	ret = tpm_errout(&ctx, "watch pcr values...\n",
+			 watch_pcrs(&ctx, ids, algs, nalg, pcr_mask, interval,
+				    binout, fpout));
+	break;
+      }
+      if(pcrcachefile && !tpm_has_update_counter(&ctx)) {
+	fputs("Warning: pcr cache needs pcrUpdateCounter of tpm2, "
+	      "reading pcrs without it.\n", stderr);
+	pcrcachefile = NULL;
+      }
+      if(pcrcachefile) {
+	uint32_t cached = 0;
+	ret = tpm_errout(&ctx, "read pcr values...\n",
+			 pcrcache_read(pcrcachefile, &ctx, ids, nalg,
+				       pcr_mask, values, &cached));
+	if(ret == 0)
+	  fprintf(stderr, "%d of %d pcr(s) taken from cache %s.\n",
+		  __builtin_popcount(cached), __builtin_popcount(pcr_mask),
+		  pcrcachefile);
+      } else {
+	ret = tpm_errout(&ctx, "read pcr values...\n",
+			 tpm_pcr_read_multi(&ctx, ids, nalg, pcr_mask, values));
+      }
+      for(k = 0; k < nalg && ret == 0; k++) {
+	uint32_t i = 0;
+	for(; i < PCR_NUM; i++) {
+	  if(pcr_mask & (1u << i))
+	    outputpcr(binout, fpout, i, (nalg > 1)? algs[k]: NULL,
+		      &values[k * PCR_NUM + i]);
+	}
+      }
+    } else if(0 == strcmp("read", command)) {
       pcr value;
       ret = tpm_errout(&ctx, "read pcr value...\n",
 		   tpm_pcr_read(&ctx, pcr_index, &value));
       if(0 == ret) {
-	outputpcr(binout, fpout, pcr_index, &value);
+	outputpcr(binout, fpout, pcr_index, NULL, &value);
       }else{
 	//something wrong.
       }
     } else if (0 == strcmp("extend", command)) {
-      if(alg == NULL) {
-	fprintf(stderr, "TPM2 cannot process the digest of %s!\n", alg);
-	tpm_ctx_uninit(&ctx);
+      if(badalg != NULL) {
+	fprintf(stderr, "TPM2 cannot process the digest of %s!\n", badalg);
 	ret = -(EXIT_FAILURE);
 	break;
       }
+      if(tpm1 && nalg > 1) {
+	fputs("TPM1 has only one bank of pcrs!\n", stderr);
+	ret = -(EXIT_FAILURE);
+	break;
+      }
+      // there is no readback to skip on tpm1.
+      if(tpm1)
+	readback = READBACK_EACH;
 
       if(!OSSL_init()) {
 	fputs("Error: Unable to init OpenSSL Library!\n",stderr);
@@ -271,52 +1520,312 @@ int main(int argc, char** argv)
 	break;
       }
 
-      MDBIO* b = MDBIO_new(alg);
-      if(b == NULL) {
-	fprintf(stderr, "Error: Unable to create MDBIO: %s\n",
-		ERR_error_string(ERR_get_error(), NULL));
-	ret = -(EXIT_FAILURE);
-	break;
+      eventlog* log = NULL;
+      if(eventlogfile) {
+	log = eventlog_open(eventlogfile, algs, nalg);
+	if(log == NULL && errno == EINVAL) {
+	  fprintf(stderr, "Event log %s does not list every bank given!\n",
+		  eventlogfile);
+	} else if(log == NULL && errno == ENOTSUP) {
+	  fputs("An event log cannot hold digests of every bank given!\n",
+		stderr);
+	} else if(log == NULL && errno == EBADMSG) {
+	  fprintf(stderr, "%s is not an event log, or is corrupt!\n",
+		  eventlogfile);
+	} else if(log == NULL) {
+	  fprintf(stderr, "Unable to open event log %s: %s\n",
+		  eventlogfile, strerror(errno));
+	}
+	if(log == NULL) {
+	  ret = -(EXIT_FAILURE);
+	  OSSL_uninit();
+	  break;
+	}
       }
 
-      do {
-	int fileind = optind + 2;
-	farr* fa = openfarr(argc - fileind, (const char**)(argv + fileind));
+      int fileind = optind + 2;
+      extendjob e;
+      if(stream) {
+	if(fileind < argc || treedir) {
+	  fputs("Files could not be given along with --stream!\n", stderr);
+	  ret = -(EXIT_FAILURE);
+	} else {
+	  ret = extendjob_begin(&e, &ctx, pcr_index, ialgs, algs, nalg,
+				readback, log);
+	  if(ret == 0)
+	    ret = extend_stream(&e, buff_size);
+	  if(ret == 0)
+	    ret = extendjob_end(&e);
+	}
+	if(ret == 0) {
+	  size_t k = 0;
+	  for(; k < nalg; k++)
+	    outputpcr(binout, fpout, pcr_index,
+		      (nalg > 1)? algs[k]: NULL, &e.value[k]);
+	}
+	if(!eventlog_close(log) && ret == 0) {
+	  fprintf(stderr, "Error: Unable to sync event log %s!\n", eventlogfile);
+	  ret = -(EXIT_FAILURE);
+	}
+	OSSL_uninit();
+	break;
+      }
 
+      farr* fa = NULL;
+      mdtree* tree = NULL;
+      MDSET* manifest = NULL;
+      FILE* fpmanifest = NULL;
+      size_t num = 0;
+      const char** names = NULL;
+      if(treedir) {
+	if(fileind < argc) {
+	  fputs("Files could not be given along with --tree!\n", stderr);
+	  ret = -(EXIT_FAILURE);
+	  eventlog_close(log);
+	  OSSL_uninit();
+	  break;
+	}
+	tree = mdtree_walk(treedir, jobs);
+	if(tree == NULL) {
+	  fprintf(stderr, "unable to walk through %s!\n", treedir);
+	  ret = -(EXIT_FAILURE);
+	  eventlog_close(log);
+	  OSSL_uninit();
+	  break;
+	}
+	fprintf(stderr,
+		"tree %s: %zu file(s) in %zu director(ies), "
+		"%zu other entr(ies) skipped.\n",
+		treedir, tree->num, tree->dirs, tree->skipped);
+	num = tree->num;
+	names = (const char**)tree->paths;
+      } else {
+	fa = openfarr(argc - fileind, (const char**)(argv + fileind));
 	if(fa == NULL) {
 	  fputs("unable to open all given files!\n", stderr);
+	  ret = -(EXIT_FAILURE);
+	  eventlog_close(log);
+	  OSSL_uninit();
 	  break;
 	}
+	num = fa->num;
+	names = (const char**)(argv + fileind);
+	tree_manifest = false;
+      }
+      size_t merkle_workers = jobs;
+      if(jobs > num)
+	jobs = num? num: 1;
 
-	
+      MDSET* sets[jobs];
+      double busy[jobs];
+      hashjob h = (hashjob){fa, tree, sets, NULL, 0, buff_size, iomode, NULL,
+			    busy, names, algs,
+			    measure_merkle? &merkle: NULL, merkle_workers,
+			    verity, 0};
+      workq* q = NULL;
+      {
+	size_t i = 0;
+	for(; i < jobs; i++) {
+	  busy[i] = 0;
+	  sets[i] = MDSET_new(algs, nalg);
+	  if(sets[i] == NULL) {
+	    fprintf(stderr, "Error: Unable to create MDSET: %s\n",
+		    ERR_error_string(ERR_get_error(), NULL));
+	    ret = -(EXIT_FAILURE);
+	    break;
+	  }
+	}
+	jobs = i;
+      }
 
-	pcr value;
-	char buf[MDBIO_md_size(b)];
+      do {
+	if(ret != 0)
+	  break;
+	if(num == 0 && !tree_manifest)
+	  break;
+
+	size_t mdsize[nalg];
+	{
+	  size_t k = 0;
+	  for(; k < nalg; k++) {
+	    mdsize[k] = MDSET_md_size(sets[0], k);
+	    h.stride += mdsize[k];
+	  }
+	}
+	h.digests = (char*)malloc(h.stride * (num + 1));
+	if(h.digests == NULL) {
+	  ret = -(EXIT_FAILURE);
+	  break;
+	}
+
+	if(tree_manifest) {
+	  manifest = MDSET_new(algs, nalg);
+	  if(manifest == NULL) {
+	    ret = -(EXIT_FAILURE);
+	    break;
+	  }
+	  if(manifestfile) {
+	    fpmanifest = fopen(manifestfile, "wb");
+	    if(fpmanifest == NULL) {
+	      fprintf(stderr,
+		      "unable to open file %s to write!\n",
+		      manifestfile);
+	      ret = -(EXIT_FAILURE);
+	      break;
+	    }
+	  }
+	}
+
+	if(cachefile && measure_merkle) {
+	  fputs("Warning: digest cache is not used to measure merkle trees.\n",
+		stderr);
+	} else if(cachefile) {
+	  h.cache = mdcache_open(cachefile, MDCACHE_DEFAULT_SLOTS, cache_verify);
+	  if(h.cache == NULL)
+	    fprintf(stderr,
+		    "Warning: unable to open digest cache %s: %s, "
+		    "going ahead without it.\n",
+		    cachefile, strerror(errno));
+	}
+
+	// a merkle tree is computed with all workers, one file after another.
+	q = workq_new(measure_merkle? 1: jobs, num, hashjob_run, &h);
+	if(q == NULL) {
+	  fputs("Error: Unable to start hashing workers!\n", stderr);
+	  ret = -(EXIT_FAILURE);
+	  break;
+	}
+
+	ret = extendjob_begin(&e, &ctx, pcr_index, ialgs, algs, nalg,
+			      readback, log);
 	{
 	  size_t i = 0;
-	  for(; i < fa->num; i++){
-	    MDBIO_feed_file(b, fa->arr[i], 1024);
-	    MDBIO_getmd(b, buf, sizeof(buf));
-	    ret = tpm_errout(&ctx, "extend pcr value...\n",
-			 tpm_pcr_extend(&ctx, pcr_index,
-				    buf, sizeof(buf),
-				    &value));
-	    if(0 != ret){
+	  for(; i < num && ret == 0; i++){
+	    ret = workq_wait(q, i);
+	    if(0 != ret) {
+	      fprintf(stderr, "Error: Unable to hash %s!\n", names[i]);
 	      break;
 	    }
+	    const char* md = h.digests + i * h.stride;
+	    if(manifest) {
+	      const char* m = md;
+	      size_t k = 0;
+	      for(; k < nalg; m += mdsize[k], k++) {
+		if(!mdtree_manifest_add(manifest, k, names[i], m, mdsize[k]))
+		  ret = -(EXIT_FAILURE);
+	      }
+	      if(fpmanifest && mdtree_fprint_line(fpmanifest, names[i],
+						 md, mdsize[0]) < 0)
+		ret = -(EXIT_FAILURE);
+	      continue;
+	    }
+	    ret = extendjob_extend(&e, md, mdsize, names[i]);
+	  }
+	}
+	if(ret == 0 && manifest) {
+	  // the spare slot after digests of all files holds the manifest's.
+	  char* md = h.digests + num * h.stride;
+	  if(MDSET_getmds(manifest, md, h.stride) != h.stride) {
+	    ret = -(EXIT_FAILURE);
+	  } else {
+	    size_t k = 0;
+	    for(; k < nalg; md += mdsize[k], k++) {
+	      size_t j = 0;
+	      fprintf(stderr, "manifest of %s on %s: ", treedir, algs[k]);
+	      for(; j < mdsize[k]; j++)
+		fprintf(stderr, "%02hhx", md[j]);
+	      fputs("\n", stderr);
+	    }
+	    ret = extendjob_extend(&e, h.digests + num * h.stride, mdsize,
+				   treedir);
 	  }
 	}
 	if(ret == 0)
-	  outputpcr(binout, fpout, pcr_index, &value);
+	  ret = extendjob_end(&e);
+	if(ret == 0) {
+	  size_t k = 0;
+	  for(; k < nalg; k++)
+	    outputpcr(binout, fpout, pcr_index,
+		      (nalg > 1)? algs[k]: NULL, &e.value[k]);
+	}
+
+	{
+	  // workers run side by side, so the busiest one took the longest.
+	  uint64_t bytes = 0;
+	  double secs = 0;
+	  size_t i = 0;
+	  for(; i < jobs; i++) {
+	    bytes += sets[i]->bytes;
+	    if(busy[i] > secs)
+	      secs = busy[i];
+	  }
+	  fprintf(stderr,
+		  "hashed %llu byte(s) with %s in %.3fs, %.1f MB/s.\n",
+		  (unsigned long long)bytes,
+		  measure_merkle? "merkle tree": MDBIO_iomode_name(iomode), secs,
+		  (secs > 0)? bytes / secs / 1e6: 0.0);
+	  if(verity != VERITY_OFF)
+	    fprintf(stderr,
+		    "%zu of %zu file(s) measured with fs-verity digests.\n",
+		    h.verity_files, num);
+	}
 
       } while (0);
-      
-      BIO_free(b);
+
+      workq_free(q);
+      if(h.cache) {
+	mdcache_report(h.cache, stderr);
+	mdcache_close(h.cache);
+      }
+      free(h.digests);
+      {
+	size_t i = 0;
+	for(; i < jobs; i++)
+	  MDSET_free(sets[i]);
+      }
+      MDSET_free(manifest);
+      if(fpmanifest)
+	fclose(fpmanifest);
+      freefarr(fa);
+      mdtree_free(tree);
+      if(!eventlog_close(log) && ret == 0) {
+	fprintf(stderr, "Error: Unable to sync event log %s!\n", eventlogfile);
+	ret = -(EXIT_FAILURE);
+      }
       OSSL_uninit();
+    } else if (0 == strcmp("quote", command)) {
+      if(badalg != NULL) {
+	fprintf(stderr, "TPM2 cannot process the digest of %s!\n", badalg);
+	ret = -(EXIT_FAILURE);
+	break;
+      }
+      if(!tpm_has_quote(&ctx) || ak == 0) {
+	fputs(tpm_has_quote(&ctx)? "quote needs --ak!\n":
+	      "This tpm cannot quote pcrs!\n", stderr);
+	ret = -(EXIT_FAILURE);
+	break;
+      }
+      uint32_t ids[nalg];
+      size_t k = 0;
+      for(; k < nalg; k++)
+	ids[k] = ialgs[k]->id;
+      ret = tpm_errout(&ctx, "quote pcr values...\n",
+		       quote_pcrs(&ctx, ids, nalg, pcr_mask, ak,
+				  (nonce_len != (size_t)-1)? (char*)nonce: NULL,
+				  (nonce_len != (size_t)-1)? nonce_len: 0,
+				  fpout));
+    } else if (serving) {
+      const char* path = socketpath? socketpath: PCRD_DEFAULT_SOCKET;
+      fprintf(stderr, "Serving tpm%s at %s...\n", t->tpm_version, path);
+      if(pcrd_serve(&ctx, path) != 0) {
+	fprintf(stderr, "unable to serve at %s: %s\n", path, strerror(errno));
+	ret = -(EXIT_FAILURE);
+      }
     } else if (0 == strcmp("clear", command)) {
-      ret = tpm_errout(&ctx, "clear pcr value...\n", tpm_pcr_reset(&ctx, pcr_index));
+      ret = tpm_errout(&ctx, "clear pcr value...\n",
+		       tpm_pcr_reset_multi(&ctx, pcr_mask));
     } else if (0 == strcmp("setalg", command)) {
-      if(t == &tpm12_pcr_vtbl) {
+      if(tpm1) {
 	fputs("TPM1 does not support to set pcr's algorithm!\n", stderr);
 	ret = -(EXIT_FAILURE);
 	break;
@@ -356,8 +1865,10 @@ int main(int argc, char** argv)
   } while (0);
 
   tpm_ctx_uninit(&ctx);
-  if (fpout != stdout)
+  if (fpout != stdout && fpout != stderr)
     fclose(fpout);
+  if(stats_enabled())
+    stats_report(stderr, stats_json);
   
   return ret;
 }
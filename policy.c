@@ -0,0 +1,267 @@
+/* 
+ * policy.c
+ * TPM2_PolicyPCR digests of predicted pcr values, computed in software.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "policy.h"
+#include "tpm2.h"
+#include "tpm2_md_alg.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* const policy_algnames[] = {
+  "sha1", "sha256", "sha384", "sha512", NULL
+};
+
+// the supported algorithm of id, or the only one of size if id is 0.
+static const char* policy_algname(uint32_t id, size_t size)
+{
+  size_t i = 0;
+  for(; policy_algnames[i]; i++) {
+    const tpm2_hashalg_list_item* ialg =
+      MD_tpm2_checksupport(policy_algnames[i]);
+    const EVP_MD* md = EVP_get_digestbyname(policy_algnames[i]);
+    if(ialg == NULL || md == NULL)
+      continue;
+    if(id != 0? ialg->id == id: EVP_MD_size(md) == size)
+      return policy_algnames[i];
+  }
+  return NULL;
+}
+
+/*
+ * a pcr of md extended once, from zeros, with the digest of file. the
+ * manifest must list digests of md, as the pcr was extended with the
+ * digest of the listing of its own bank, while --manifest writes only
+ * the listing of the first algorithm.
+ */
+static const char* policy_extend_file(const EVP_MD* md, const char* file,
+				      pcr* v)
+{
+  char buf[65536];
+  unsigned char d[2 * EVP_MAX_MD_SIZE];
+  size_t size = EVP_MD_size(md);
+  size_t n = 0;
+  bool first = true;
+  const char* why = "unable to digest a manifest";
+  FILE* fp = fopen(file, "rb");
+  EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
+
+  do {
+    if(fp == NULL || mdctx == NULL || !EVP_DigestInit_ex(mdctx, md, NULL))
+      break;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+      if(first) {
+	// a line is [\\]<hex digest>  <path>, as sha1sum writes it.
+	size_t o = (buf[0] == '\\')? 1: 0;
+	size_t hex = 0;
+	for(; o + hex < n && isxdigit((unsigned char)buf[o + hex]); hex++);
+	if(hex != 2 * size || o + hex == n || buf[o + hex] != ' ') {
+	  why = "a manifest of another algorithm";
+	  break;
+	}
+	first = false;
+      }
+      EVP_DigestUpdate(mdctx, buf, n);
+    }
+    if(n > 0 || ferror(fp))
+      break;
+    memset(d, 0, size);
+    if(!EVP_DigestFinal_ex(mdctx, d + size, NULL)
+       || !EVP_Digest(d, 2 * size, (unsigned char*)v->a, NULL, md, NULL))
+      break;
+    v->s = size;
+    why = NULL;
+  } while(0);
+
+  EVP_MD_CTX_free(mdctx);
+  if(fp)
+    fclose(fp);
+  return why;
+}
+
+static unsigned char* policy_be32(unsigned char* b, uint32_t v)
+{
+  b[0] = (v >> 24) & 0xff;
+  b[1] = (v >> 16) & 0xff;
+  b[2] = (v >> 8) & 0xff;
+  b[3] = v & 0xff;
+  return b + 4;
+}
+
+static const char* policy_parse_line(const char* line, policy_pcrs* p)
+{
+  char alg[13] = "";
+  unsigned index = 0;
+  int n = 0;
+  const char* s = NULL;
+  const char* name = NULL;
+  const tpm2_hashalg_list_item* ialg = NULL;
+  pcr v = {0};
+  size_t k = 0;
+
+  if(sscanf(line, "PCR %u:%n", &index, &n) != 1 || n == 0
+     || index >= PCR_NUM)
+    return "malformed line";
+  s = line + n;
+  if(*s != ':' && sscanf(s, "%12[^:]", alg) != 1)
+    return "malformed line";
+  s += strlen(alg);
+  if(*s++ != ':')
+    return "malformed line";
+
+  if(*s == '@') {
+    char path[4096];
+    const EVP_MD* md = NULL;
+    const char* why = NULL;
+    if(alg[0] == '\0')
+      return "a manifest needs the algorithm of its pcr";
+    md = EVP_get_digestbyname(alg);
+    if(md == NULL || sscanf(s + 1, "%4095[^\n]", path) != 1)
+      return "malformed line";
+    why = policy_extend_file(md, path, &v);
+    if(why != NULL)
+      return why;
+  } else {
+    size_t len = 0;
+    while(len < sizeof(v.a) && sscanf(s, "%2hhx", &v.a[len]) == 1) {
+      len ++;
+      s += 2;
+      if(*s != ':')
+	break;
+      s ++;
+    }
+    if(*s != '\n' && *s != '\0')
+      return "malformed value";
+    v.s = len;
+  }
+
+  name = alg[0]? alg: policy_algname(0, v.s);
+  ialg = name? MD_tpm2_checksupport(name): NULL;
+  if(ialg == NULL)
+    return "unknown algorithm";
+  if(EVP_MD_size(EVP_get_digestbyname(name)) != v.s)
+    return "value of a wrong size";
+
+  for(; k < p->nalg && p->algs[k] != ialg->id; k++);
+  if(k == p->nalg) {
+    if(p->nalg == POLICY_MAX_BANKS)
+      return "too many banks";
+    p->algs[p->nalg ++] = ialg->id;
+  }
+  p->values[k * PCR_NUM + index] = v;
+  p->masks[k] |= 1u << index;
+  return NULL;
+}
+
+const char* policy_load(const char* path, policy_pcrs* p)
+{
+  char line[8192];
+  const char* why = NULL;
+  FILE* fp = fopen(path, "r");
+  if(fp == NULL)
+    return "unable to open";
+
+  memset(p, 0, sizeof(*p));
+  while(why == NULL && fgets(line, sizeof(line), fp) != NULL) {
+    if(line[0] == '\n' || line[0] == '#')
+      continue;
+    why = policy_parse_line(line, p);
+  }
+  fclose(fp);
+  return why;
+}
+
+const char* policy_pcr_digest(const EVP_MD* md, const void* selection,
+			      const policy_pcrs* p, char* digest)
+{
+  const TPML_PCR_SELECTION* sel = (const TPML_PCR_SELECTION*)selection;
+  unsigned char buf[4 + 4 + HASH_COUNT * (2 + 1 + sizeof(TPMU_HA))
+		    + EVP_MAX_MD_SIZE];
+  unsigned char* b = buf;
+  size_t size = EVP_MD_size(md);
+  const char* why = NULL;
+  uint32_t k = 0;
+  EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
+  if(mdctx == NULL || !EVP_DigestInit_ex(mdctx, md, NULL)) {
+    EVP_MD_CTX_free(mdctx);
+    return "out of memory";
+  }
+
+  // TPM_CC_PolicyPCR and TPML_PCR_SELECTION, marshaled big-endian.
+  b = policy_be32(b, TPM_CC_PolicyPCR);
+  b = policy_be32(b, sel->count);
+  for(; k < sel->count && why == NULL; k++) {
+    const TPMS_PCR_SELECTION* s = &sel->pcrSelections[k];
+    size_t j = 0;
+    uint32_t i = 0;
+    *b++ = (s->hash >> 8) & 0xff;
+    *b++ = s->hash & 0xff;
+    *b++ = s->sizeofSelect;
+    memcpy(b, s->pcrSelect, s->sizeofSelect);
+    b += s->sizeofSelect;
+
+    for(; j < p->nalg && p->algs[j] != s->hash; j++);
+    for(; i < PCR_NUM && i < 8u * s->sizeofSelect; i++) {
+      if(!(s->pcrSelect[i / 8] & (1u << (i % 8))))
+	continue;
+      if(j == p->nalg || !(p->masks[j] & (1u << i))) {
+	why = "a pcr selected is not predicted";
+	break;
+      }
+      EVP_DigestUpdate(mdctx, p->values[j * PCR_NUM + i].a,
+		       p->values[j * PCR_NUM + i].s);
+    }
+  }
+  // pcrDigest after them.
+  if(why == NULL && !EVP_DigestFinal_ex(mdctx, b, NULL))
+    why = "unable to digest pcrs";
+  EVP_MD_CTX_free(mdctx);
+  if(why != NULL)
+    return why;
+  b += size;
+
+  // extending the policyDigest of a new session, which is zeros.
+  {
+    unsigned char zeros[EVP_MAX_MD_SIZE] = {0};
+    mdctx = EVP_MD_CTX_new();
+    if(mdctx == NULL
+       || !EVP_DigestInit_ex(mdctx, md, NULL)
+       || !EVP_DigestUpdate(mdctx, zeros, size)
+       || !EVP_DigestUpdate(mdctx, buf, b - buf)
+       || !EVP_DigestFinal_ex(mdctx, (unsigned char*)digest, NULL))
+      why = "unable to digest the policy";
+    EVP_MD_CTX_free(mdctx);
+  }
+  return why;
+}
@@ -0,0 +1,95 @@
+/* 
+ * policy.h
+ * TPM2_PolicyPCR digests of predicted pcr values, computed in software.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _POLICY_H_
+#define _POLICY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include "tpm_common.h"
+#include <openssl/evp.h>
+
+/*
+ * The digest a trial session reaches with TPM2_PolicyPCR over the pcrs
+ * of a selection (as parse_selection returns it), so an object can be
+ * sealed to values of pcrs the tpm does not hold yet:
+ *
+ *   H(zeros || TPM_CC_PolicyPCR || TPML_PCR_SELECTION || H(values))
+ *
+ * with values of the banks in the order of the selection, each in
+ * ascending order of pcrs. Predicted values are read from a file in the
+ * format of read, one per line:
+ *
+ *   PCR <index>:<alg>:<hex, in bytes separated by ':'>
+ *
+ * where alg may be left out for a value of the size of only one
+ * algorithm, or with the value as @FILE, for a pcr extended once from
+ * zeros with the digest of FILE, as extend --tree does with a manifest.
+ * FILE must list digests of the algorithm of its pcr, so a manifest
+ * written by --manifest predicts only the bank of the first algorithm.
+ */
+
+#define POLICY_MAX_BANKS 5
+
+typedef struct policy_pcrs {
+  size_t nalg;
+  uint32_t algs[POLICY_MAX_BANKS];
+  uint32_t masks[POLICY_MAX_BANKS]; // of pcrs predicted on each bank.
+  pcr values[POLICY_MAX_BANKS * PCR_NUM];
+} policy_pcrs;
+
+// returns NULL if values are loaded from path, or why not.
+const char* policy_load(const char* path, policy_pcrs* p);
+
+/*
+ * digest of the PolicyPCR over selection with values in p, in md, into
+ * digest, which holds EVP_MAX_MD_SIZE bytes. returns NULL if done, or why
+ * not.
+ */
+const char* policy_pcr_digest(const EVP_MD* md, const void* selection,
+			      const policy_pcrs* p, char* digest);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
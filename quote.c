@@ -0,0 +1,362 @@
+/* 
+ * quote.c
+ * Quotes of pcrs, saved along with the values quoted, and verified offline.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "quote.h"
+#include <string.h>
+#include <openssl/ecdsa.h>
+#include <openssl/rsa.h>
+
+#define QUOTE_GENERATED 0xff544347 // TPM_GENERATED_VALUE
+#define QUOTE_ST_ATTEST 0x8018 // TPM_ST_ATTEST_QUOTE
+#define QUOTE_ALG_RSASSA 0x0014
+#define QUOTE_ALG_RSAPSS 0x0016
+#define QUOTE_ALG_ECDSA 0x0018
+
+static const struct {
+  uint32_t id;
+  const char* name;
+} quote_hashalgs[] = {
+  {0x0004, "sha1"},
+  {0x000b, "sha256"},
+  {0x000c, "sha384"},
+  {0x000d, "sha512"},
+  {0, NULL}
+};
+
+static const EVP_MD* quote_md(uint32_t alg)
+{
+  size_t i = 0;
+  for(; quote_hashalgs[i].name; i++)
+    if(quote_hashalgs[i].id == alg)
+      return EVP_get_digestbyname(quote_hashalgs[i].name);
+  return NULL;
+}
+
+static void quote_fprint_hex(FILE* fp, const char* buf, size_t len)
+{
+  size_t i = 0;
+  for(; i < len; i++)
+    fprintf(fp, "%02hhx", buf[i]);
+}
+
+int quote_fprint(FILE* fp, const quote_file* f)
+{
+  size_t k = 0;
+  fprintf(fp, "quote %x %x\nattest ", f->q.sig_alg, f->q.hash_alg);
+  quote_fprint_hex(fp, f->q.attest, f->q.attest_size);
+  fputs("\nsignature ", fp);
+  quote_fprint_hex(fp, f->q.sig, f->q.sig_size);
+  fputs("\n", fp);
+  for(; k < f->nalg; k++) {
+    uint32_t i = 0;
+    for(; i < PCR_NUM; i++) {
+      const pcr* v = &f->values[k * PCR_NUM + i];
+      if(!(f->pcr_mask & (1u << i)) || v->s == 0)
+	continue;
+      fprintf(fp, "pcr %x %u ", f->algs[k], i);
+      quote_fprint_hex(fp, v->a, v->s);
+      fputs("\n", fp);
+    }
+  }
+  return ferror(fp)? -1: 0;
+}
+
+static size_t quote_parse_hex(const char* s, char* buf, size_t max)
+{
+  size_t n = 0;
+  size_t len = strcspn(s, " \n");
+  if(len % 2 != 0 || len / 2 > max)
+    return (size_t)-1;
+  for(; n < len / 2; n++) {
+    if(sscanf(s + 2 * n, "%2hhx", &buf[n]) != 1)
+      return (size_t)-1;
+  }
+  return n;
+}
+
+bool quote_load(const char* path, quote_file* f)
+{
+  char line[2 * (QUOTE_MAX_ATTEST + QUOTE_MAX_SIG) + 64];
+  bool ok = true;
+  FILE* fp = fopen(path, "r");
+  if(fp == NULL)
+    return false;
+
+  memset(f, 0, sizeof(*f));
+  while(ok && fgets(line, sizeof(line), fp) != NULL) {
+    uint32_t alg = 0;
+    uint32_t index = 0;
+    int n = 0;
+    if(0 == strncmp(line, "quote ", 6)) {
+      ok = (sscanf(line + 6, "%x %x", &f->q.sig_alg, &f->q.hash_alg) == 2);
+    } else if(0 == strncmp(line, "attest ", 7)) {
+      f->q.attest_size = quote_parse_hex(line + 7, f->q.attest,
+					 sizeof(f->q.attest));
+      ok = (f->q.attest_size != (size_t)-1);
+    } else if(0 == strncmp(line, "signature ", 10)) {
+      f->q.sig_size = quote_parse_hex(line + 10, f->q.sig,
+				      sizeof(f->q.sig));
+      ok = (f->q.sig_size != (size_t)-1);
+    } else if(sscanf(line, "pcr %x %u %n", &alg, &index, &n) == 2
+	      && n > 0 && index < PCR_NUM) {
+      size_t k = 0;
+      pcr* v = NULL;
+      for(; k < f->nalg && f->algs[k] != alg; k++);
+      if(k == f->nalg) {
+	if(f->nalg == QUOTE_MAX_BANKS) {
+	  ok = false;
+	  break;
+	}
+	f->algs[f->nalg ++] = alg;
+      }
+      v = &f->values[k * PCR_NUM + index];
+      size_t s = quote_parse_hex(line + n, v->a, sizeof(v->a));
+      ok = (s != (size_t)-1 && s != 0);
+      v->s = ok? s: 0;
+      f->pcr_mask |= 1u << index;
+    } else {
+      ok = false;
+    }
+  }
+  fclose(fp);
+  return ok && f->q.attest_size != 0 && f->q.sig_size != 0;
+}
+
+/*
+ * a reader of the attest, which is marshaled big-endian, with TPM2Bs as
+ * a 16-bit size then as many bytes.
+ */
+typedef struct quote_reader {
+  const unsigned char* p;
+  size_t left;
+} quote_reader;
+
+static bool quote_take(quote_reader* r, size_t n, const unsigned char** out)
+{
+  if(r->left < n)
+    return false;
+  if(out)
+    *out = r->p;
+  r->p += n;
+  r->left -= n;
+  return true;
+}
+
+static bool quote_uint(quote_reader* r, size_t n, uint32_t* v)
+{
+  const unsigned char* p = NULL;
+  size_t i = 0;
+  if(!quote_take(r, n, &p))
+    return false;
+  for(*v = 0; i < n; i++)
+    *v = (*v << 8) | p[i];
+  return true;
+}
+
+static bool quote_tpm2b(quote_reader* r, const unsigned char** buf,
+			uint32_t* size)
+{
+  return quote_uint(r, 2, size) && quote_take(r, *size, buf);
+}
+
+// the digest of the values saved over the selection quoted, in its order.
+static const char* quote_pcr_digest(const quote_file* f, quote_reader* r,
+				    const EVP_MD* md, unsigned char* digest,
+				    unsigned int* len)
+{
+  const char* why = NULL;
+  uint32_t count = 0;
+  uint32_t j = 0;
+  bool quoted[QUOTE_MAX_BANKS] = {false}; // every bank saved, only once.
+  EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
+  if(mdctx == NULL || !EVP_DigestInit_ex(mdctx, md, NULL)) {
+    EVP_MD_CTX_free(mdctx);
+    return "out of memory";
+  }
+
+  if(!quote_uint(r, 4, &count))
+    why = "truncated attest";
+  for(; j < count && why == NULL; j++) {
+    uint32_t alg = 0;
+    uint32_t sizeofselect = 0;
+    const unsigned char* select = NULL;
+    uint32_t mask = 0;
+    size_t k = 0;
+    uint32_t i = 0;
+    if(!quote_uint(r, 2, &alg) || !quote_uint(r, 1, &sizeofselect)
+       || !quote_take(r, sizeofselect, &select)) {
+      why = "truncated attest";
+      break;
+    }
+    for(; i < sizeofselect; i++) {
+      if(i >= 4 && select[i] != 0)
+	break; // a pcr beyond the ones saved.
+      if(i < 4)
+	mask |= (uint32_t)select[i] << (8 * i);
+    }
+    for(; k < f->nalg && f->algs[k] != alg; k++);
+    if(i < sizeofselect || k == f->nalg || quoted[k]
+       || mask != f->pcr_mask) {
+      why = "pcrs quoted are not the ones saved";
+      break;
+    }
+    quoted[k] = true;
+    for(i = 0; i < PCR_NUM; i++) {
+      const pcr* v = &f->values[k * PCR_NUM + i];
+      if(!(mask & (1u << i)))
+	continue;
+      if(v->s == 0) {
+	why = "pcrs quoted are not the ones saved";
+	break;
+      }
+      EVP_DigestUpdate(mdctx, v->a, v->s);
+    }
+  }
+  if(why == NULL && count != f->nalg)
+    why = "pcrs quoted are not the ones saved";
+  if(why == NULL && !EVP_DigestFinal_ex(mdctx, digest, len))
+    why = "unable to digest pcrs";
+  EVP_MD_CTX_free(mdctx);
+  return why;
+}
+
+static bool quote_verify_sig(const quote_file* f, EVP_PKEY* ak,
+			     const EVP_MD* md)
+{
+  bool ok = false;
+  unsigned char* der = NULL;
+  const unsigned char* sig = (const unsigned char*)f->q.sig;
+  size_t siglen = f->q.sig_size;
+  EVP_PKEY_CTX* pctx = NULL;
+  EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
+  if(mdctx == NULL)
+    return false;
+
+  do {
+    if(f->q.sig_alg == QUOTE_ALG_ECDSA) {
+      // openssl takes ecdsa signatures in der.
+      size_t half = siglen / 2;
+      ECDSA_SIG* es = ECDSA_SIG_new();
+      BIGNUM* r = BN_bin2bn(sig, half, NULL);
+      BIGNUM* s = BN_bin2bn(sig + half, half, NULL);
+      int len = 0;
+      if(es == NULL || r == NULL || s == NULL || !ECDSA_SIG_set0(es, r, s)) {
+	BN_free(r);
+	BN_free(s);
+	ECDSA_SIG_free(es);
+	break;
+      }
+      len = i2d_ECDSA_SIG(es, &der);
+      ECDSA_SIG_free(es);
+      if(len <= 0)
+	break;
+      sig = der;
+      siglen = len;
+    } else if(f->q.sig_alg != QUOTE_ALG_RSASSA
+	      && f->q.sig_alg != QUOTE_ALG_RSAPSS) {
+      break;
+    }
+
+    if(EVP_DigestVerifyInit(mdctx, &pctx, md, NULL, ak) != 1)
+      break;
+    if(f->q.sig_alg == QUOTE_ALG_RSAPSS
+       && (EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PSS_PADDING) != 1
+	   || EVP_PKEY_CTX_set_rsa_pss_saltlen(pctx,
+					       RSA_PSS_SALTLEN_AUTO) != 1))
+      break;
+    ok = (EVP_DigestVerify(mdctx, sig, siglen,
+			   (const unsigned char*)f->q.attest,
+			   f->q.attest_size) == 1);
+  } while(0);
+
+  OPENSSL_free(der);
+  EVP_MD_CTX_free(mdctx);
+  return ok;
+}
+
+// check the attest, with md of the signing scheme, against the values.
+static const char* quote_check_attest(const quote_file* f, const EVP_MD* md,
+				      const char* nonce, size_t nonce_len)
+{
+  quote_reader r = {(const unsigned char*)f->q.attest, f->q.attest_size};
+  const unsigned char* extra = NULL;
+  const unsigned char* pcrdigest = NULL;
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int len = 0;
+  uint32_t v = 0;
+  uint32_t size = 0;
+  const char* why = NULL;
+
+  // TPMS_ATTEST, of type TPM_ST_ATTEST_QUOTE.
+  if(!quote_uint(&r, 4, &v) || v != QUOTE_GENERATED)
+    return "attest not generated by a tpm";
+  if(!quote_uint(&r, 2, &v) || v != QUOTE_ST_ATTEST)
+    return "attest is not a quote";
+  if(!quote_tpm2b(&r, NULL, &size) // qualifiedSigner
+     || !quote_tpm2b(&r, &extra, &size) // extraData
+     || !quote_take(&r, 8 + 4 + 4 + 1, NULL) // clockInfo
+     || !quote_take(&r, 8, NULL)) // firmwareVersion
+    return "truncated attest";
+  if(nonce != NULL
+     && (size != nonce_len || 0 != memcmp(extra, nonce, nonce_len)))
+    return "nonce mismatch";
+
+  why = quote_pcr_digest(f, &r, md, digest, &len);
+  if(why != NULL)
+    return why;
+  if(!quote_tpm2b(&r, &pcrdigest, &size))
+    return "truncated attest";
+  if(size != len || 0 != memcmp(pcrdigest, digest, len))
+    return "pcr values do not match pcrDigest";
+  return NULL;
+}
+
+const char* quote_verify(const quote_file* f, EVP_PKEY* ak,
+			 const char* nonce, size_t nonce_len)
+{
+  const EVP_MD* md = quote_md(f->q.hash_alg);
+  if(md == NULL)
+    return "unknown hash algorithm";
+  if(!quote_verify_sig(f, ak, md))
+    return "bad signature";
+  return quote_check_attest(f, md, nonce, nonce_len);
+}
+
+const char* quote_check_values(const quote_file* f)
+{
+  const EVP_MD* md = quote_md(f->q.hash_alg);
+  if(md == NULL)
+    return "unknown hash algorithm";
+  return quote_check_attest(f, md, NULL, 0);
+}
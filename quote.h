@@ -0,0 +1,97 @@
+/* 
+ * quote.h
+ * Quotes of pcrs, saved along with the values quoted, and verified offline.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _QUOTE_H_
+#define _QUOTE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include "tpm_common.h"
+#include <openssl/evp.h>
+
+/*
+ * A quote is saved in a text file along with the pcr values it covers,
+ * one field per line:
+ *
+ *   quote <sig_alg> <hash_alg>
+ *   attest <hex of TPMS_ATTEST>
+ *   signature <hex>
+ *   pcr <alg> <index> <hex of value>
+ *
+ * with algorithms as hex TPM_ALG_ ids. Verifying needs neither a tpm nor
+ * the TSS: the attest is unmarshaled here, its signature checked with the
+ * public part of the attestation key, and its pcrDigest against the
+ * digest of the values saved.
+ */
+
+#define QUOTE_MAX_BANKS 5
+
+typedef struct quote_file {
+  pcr_quote q;
+  size_t nalg;
+  uint32_t algs[QUOTE_MAX_BANKS];
+  uint32_t pcr_mask;
+  pcr values[QUOTE_MAX_BANKS * PCR_NUM]; // as pcr_read_multi fills them.
+} quote_file;
+
+int quote_fprint(FILE* fp, const quote_file* f);
+bool quote_load(const char* path, quote_file* f);
+
+/*
+ * returns NULL if the quote is signed by ak over the values saved (and
+ * with nonce as its qualifying data, if nonce is not NULL), or why not.
+ */
+const char* quote_verify(const quote_file* f, EVP_PKEY* ak,
+			 const char* nonce, size_t nonce_len);
+
+/*
+ * returns NULL if the values saved are the ones the attest quotes, or why
+ * not, without checking the signature; for the quoter to tell the values
+ * it read are the ones quoted.
+ */
+const char* quote_check_values(const quote_file* f);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
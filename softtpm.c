@@ -0,0 +1,427 @@
+/* 
+ * softtpm.c
+ * A software tpm, keeping banks of pcrs in memory or in a state file.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "softtpm.h"
+#include "md.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sapi/tpm20.h>
+
+#define SOFTTPM_MAGIC "softtpm"
+#define SOFTTPM_VERSION 2
+// pcrs this tpm does not count in pcrUpdateCounter (TPM_PT_PCR_NO_INCREMENT).
+#define SOFTTPM_UNCOUNTED ((1u << 16) | (1u << 23))
+
+typedef struct softtpm_state {
+  char magic[8];
+  uint32_t version;
+  uint32_t allocated[SOFTTPM_BANKS]; // masks of pcrs allocated.
+  uint32_t update_counter;
+  char pcrs[SOFTTPM_BANKS][PCR_NUM][PCRSIZE];
+} softtpm_state;
+
+typedef struct softtpm_bank {
+  uint32_t id;
+  const char* name;
+  size_t size;
+} softtpm_bank;
+
+static const softtpm_bank softtpm_banks[SOFTTPM_BANKS] = {
+  {TPM_ALG_SHA1, "sha1", 20},
+  {TPM_ALG_SHA256, "sha256", 32},
+  {TPM_ALG_SHA384, "sha384", 48},
+  {TPM_ALG_SHA512, "sha512", 64},
+};
+
+static const char* softtpm_state_path = NULL;
+
+void softtpm_set_state(const char* path)
+{
+  softtpm_state_path = path;
+}
+
+/*
+ * a context keeps the state mapped in privdata[0], the algorithm set by
+ * ctx_setalg in privdata[1], and the state file (or -1) in privdata[2].
+ */
+#define SOFTTPM_STATE(ctx) ((softtpm_state*)(ctx)->privdata[0])
+
+static int softtpm_bank_of(uint32_t alg)
+{
+  int b = 0;
+  for(; b < SOFTTPM_BANKS; b++)
+    if(softtpm_banks[b].id == alg)
+      return b;
+  return -1;
+}
+
+// pcrs of a bank as they are after TPM2_Startup(CLEAR).
+static void softtpm_restart(softtpm_state* st, int b)
+{
+  size_t i = 0;
+  for(; i < PCR_NUM; i++)
+    memset(st->pcrs[b][i], (i >= 17 && i <= 22)? 0xff: 0, PCRSIZE);
+}
+
+static void softtpm_startup(softtpm_state* st)
+{
+  int b = 0;
+  memset(st, 0, sizeof(*st));
+  memcpy(st->magic, SOFTTPM_MAGIC, sizeof(st->magic));
+  st->version = SOFTTPM_VERSION;
+  for(; b < SOFTTPM_BANKS; b++) {
+    if(softtpm_banks[b].id == TPM_ALG_SHA1
+       || softtpm_banks[b].id == TPM_ALG_SHA256)
+      st->allocated[b] = (1u << PCR_NUM) - 1;
+    softtpm_restart(st, b);
+  }
+}
+
+static FP_tpm_errout(softtpm_errout)
+{
+  const char* why = "";
+  switch(ret) {
+  case SOFTTPM_E_HASH:
+    why = " (algorithm not implemented by soft tpm)";
+    break;
+  case SOFTTPM_E_SIZE:
+    why = " (digest of a wrong size)";
+    break;
+  case SOFTTPM_E_VALUE:
+    why = " (no such pcr)";
+    break;
+  case SOFTTPM_E_LOCALITY:
+    why = " (pcr not resettable from locality 0)";
+    break;
+  case SOFTTPM_E_IO:
+    why = " (unable to use the soft tpm state file)";
+    break;
+  }
+  fprintf(stderr, "%s0x%x%s\n", message, ret, why);
+  return ret;
+}
+
+static FP_ctx_init(softtpm_ctx_init)
+{
+  softtpm_state* st = MAP_FAILED;
+  int fd = -1;
+  bool fresh = true;
+
+  ctx->privdata[0] = 0;
+  ctx->privdata[1] = TPM_ALG_SHA1;
+  ctx->privdata[2] = (uintptr_t)-1;
+  if(softtpm_state_path == NULL) {
+    st = mmap(NULL, sizeof(*st), PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    struct stat sb;
+    fd = open(softtpm_state_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd < 0)
+      return SOFTTPM_E_IO;
+    // held till the state is checked, or started by the first one.
+    if(flock(fd, LOCK_EX) != 0 || fstat(fd, &sb) != 0
+       || (sb.st_size != 0 && sb.st_size != sizeof(*st))
+       || (sb.st_size == 0 && ftruncate(fd, sizeof(*st)) != 0)) {
+      close(fd);
+      return SOFTTPM_E_IO;
+    }
+    fresh = (sb.st_size == 0);
+    st = mmap(NULL, sizeof(*st), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if(st == MAP_FAILED) {
+    if(fd >= 0)
+      close(fd);
+    return SOFTTPM_E_IO;
+  }
+
+  // a state file left empty by a crash is started afresh as well.
+  if(fresh || st->magic[0] == '\0') {
+    softtpm_startup(st);
+  } else if(0 != memcmp(st->magic, SOFTTPM_MAGIC, sizeof(st->magic))
+	    || st->version != SOFTTPM_VERSION) {
+    munmap(st, sizeof(*st));
+    close(fd);
+    return SOFTTPM_E_IO;
+  }
+  if(fd >= 0)
+    flock(fd, LOCK_UN);
+  ctx->privdata[0] = (uintptr_t)st;
+  ctx->privdata[2] = fd;
+  return 0;
+}
+
+static FP_ctx_uninit(softtpm_ctx_uninit)
+{
+  int fd = (int)ctx->privdata[2];
+  if(SOFTTPM_STATE(ctx))
+    munmap(SOFTTPM_STATE(ctx), sizeof(softtpm_state));
+  if(fd >= 0)
+    close(fd);
+  ctx->privdata[0] = 0;
+  ctx->privdata[2] = (uintptr_t)-1;
+  return 0;
+}
+
+static FP_ctx_freemem(softtpm_ctx_freemem)
+{
+  free(ptr);
+}
+
+static uint32_t softtpm_read(const softtpm_state* st,
+			     const uint32_t* algs, size_t nalg,
+			     uint32_t pcr_mask, pcr* pcrvalues)
+{
+  size_t k = 0;
+  for(; k < nalg; k++) {
+    int b = softtpm_bank_of(algs[k]);
+    size_t i = 0;
+    if(b < 0)
+      return SOFTTPM_E_HASH;
+    for(; i < PCR_NUM; i++) {
+      pcr* v = &pcrvalues[k * PCR_NUM + i];
+      v->s = 0;
+      if((pcr_mask & (1u << i)) && (st->allocated[b] & (1u << i))) {
+	memcpy(v->a, st->pcrs[b][i], softtpm_banks[b].size);
+	v->s = softtpm_banks[b].size;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * as a tpm2 does, digests are checked on all banks before any is
+ * extended, and banks without the pcr allocated ignore theirs.
+ */
+static uint32_t softtpm_extend(softtpm_state* st, uint32_t pcr_index,
+			       const uint32_t* algs, size_t nalg,
+			       const char* data, const uint32_t* datalen)
+{
+  const char* d = data;
+  size_t k = 0;
+  if(pcr_index >= PCR_NUM)
+    return SOFTTPM_E_VALUE;
+  for(; k < nalg; d += datalen[k], k++) {
+    int b = softtpm_bank_of(algs[k]);
+    if(b < 0)
+      return SOFTTPM_E_HASH;
+    if(datalen[k] != softtpm_banks[b].size)
+      return SOFTTPM_E_SIZE;
+  }
+
+  for(d = data, k = 0; k < nalg; d += datalen[k], k++) {
+    int b = softtpm_bank_of(algs[k]);
+    if(!(st->allocated[b] & (1u << pcr_index)))
+      continue;
+    if(MD_extend(softtpm_banks[b].name, st->pcrs[b][pcr_index],
+		 softtpm_banks[b].size, d, datalen[k]) == 0)
+      return SOFTTPM_E_HASH;
+  }
+  if(!(SOFTTPM_UNCOUNTED & (1u << pcr_index)))
+    st->update_counter ++;
+  return 0;
+}
+
+static uint32_t softtpm_reset(softtpm_state* st, uint32_t pcr_index)
+{
+  int b = 0;
+  if(pcr_index >= PCR_NUM)
+    return SOFTTPM_E_VALUE;
+  if(pcr_index != 16 && pcr_index != 23)
+    return SOFTTPM_E_LOCALITY;
+  for(; b < SOFTTPM_BANKS; b++)
+    memset(st->pcrs[b][pcr_index], 0, PCRSIZE);
+  return 0;
+}
+
+/*
+ * banks left out of the selection keep their allocation, as with
+ * PCR_Allocate, but a bank with its allocation changed is restarted
+ * at once, rather than at the next TPM2_Startup.
+ */
+static uint32_t softtpm_allocate(softtpm_state* st,
+				 const TPML_PCR_SELECTION* sel)
+{
+  size_t k = 0;
+  for(; k < sel->count; k++) {
+    if(softtpm_bank_of(sel->pcrSelections[k].hash) < 0)
+      return SOFTTPM_E_HASH;
+  }
+
+  for(k = 0; k < sel->count; k++) {
+    const TPMS_PCR_SELECTION* s = &sel->pcrSelections[k];
+    int b = softtpm_bank_of(s->hash);
+    uint32_t mask = 0;
+    size_t j = 0;
+    for(; j < s->sizeofSelect && j * 8 < PCR_NUM; j++)
+      mask |= (uint32_t)(uint8_t)s->pcrSelect[j] << (j * 8);
+    if(mask != st->allocated[b]) {
+      st->allocated[b] = mask;
+      softtpm_restart(st, b);
+      st->update_counter ++;
+    }
+  }
+  return 0;
+}
+
+/*
+ * every command holds the lock of the state file (if any), so that soft
+ * tpms of several processes on one file act as a single tpm does.
+ */
+static void softtpm_lock(pcr_context_base* ctx, int op)
+{
+  int fd = (int)ctx->privdata[2];
+  if(fd >= 0)
+    flock(fd, op);
+}
+
+static FP_pcr_read_multi(softtpm_pcr_read_multi)
+{
+  uint32_t ret = 0;
+  softtpm_lock(ctx, LOCK_SH);
+  ret = softtpm_read(SOFTTPM_STATE(ctx), algs, nalg, pcr_mask, pcrvalues);
+  softtpm_lock(ctx, LOCK_UN);
+  return ret;
+}
+
+static FP_pcr_read_counter(softtpm_pcr_read_counter)
+{
+  uint32_t ret = 0;
+  softtpm_lock(ctx, LOCK_SH);
+  ret = softtpm_read(SOFTTPM_STATE(ctx), algs, nalg, pcr_mask, pcrvalues);
+  *counter = SOFTTPM_STATE(ctx)->update_counter;
+  softtpm_lock(ctx, LOCK_UN);
+  return ret;
+}
+
+static FP_pcr_read(softtpm_pcr_read)
+{
+  uint32_t alg = ctx->privdata[1];
+  pcr values[PCR_NUM];
+  uint32_t ret = 0;
+  if(pcr_index >= PCR_NUM)
+    return SOFTTPM_E_VALUE;
+  ret = softtpm_pcr_read_multi(ctx, &alg, 1, 1u << pcr_index, values);
+  if(ret == 0)
+    *pcrvalue = values[pcr_index];
+  return ret;
+}
+
+static FP_pcr_extend_multi(softtpm_pcr_extend_multi)
+{
+  pcr values[nalg * PCR_NUM];
+  uint32_t ret = 0;
+  size_t k = 0;
+  softtpm_lock(ctx, LOCK_EX);
+  ret = softtpm_extend(SOFTTPM_STATE(ctx), pcr_index,
+		       algs, nalg, data, datalen);
+  if(ret == 0 && newvalues != NULL)
+    ret = softtpm_read(SOFTTPM_STATE(ctx), algs, nalg,
+		       1u << pcr_index, values);
+  softtpm_lock(ctx, LOCK_UN);
+  for(; k < nalg && ret == 0 && newvalues != NULL; k++)
+    newvalues[k] = values[k * PCR_NUM + pcr_index];
+  return ret;
+}
+
+static FP_pcr_extend(softtpm_pcr_extend)
+{
+  uint32_t alg = ctx->privdata[1];
+  return softtpm_pcr_extend_multi(ctx, pcr_index, &alg, 1,
+				  data, &datalen, newvalue);
+}
+
+static FP_pcr_reset_multi(softtpm_pcr_reset_multi)
+{
+  uint32_t ret = 0;
+  uint32_t i = 0;
+  softtpm_lock(ctx, LOCK_EX);
+  for(; i < PCR_NUM && ret == 0; i++) {
+    if(pcr_mask & (1u << i))
+      ret = softtpm_reset(SOFTTPM_STATE(ctx), i);
+  }
+  softtpm_lock(ctx, LOCK_UN);
+  return ret;
+}
+
+static FP_pcr_reset(softtpm_pcr_reset)
+{
+  return softtpm_pcr_reset_multi(ctx, 1u << pcr_index);
+}
+
+static FP_pcr_setalg(softtpm_pcr_setalg)
+{
+  uint32_t ret = 0;
+  softtpm_lock(ctx, LOCK_EX);
+  ret = softtpm_allocate(SOFTTPM_STATE(ctx),
+			 (const TPML_PCR_SELECTION*)selection);
+  softtpm_lock(ctx, LOCK_UN);
+  return ret;
+}
+
+static FP_ctx_setalg(softtpm_ctx_setalg)
+{
+  ctx->privdata[1] = alg;
+}
+
+static const tpm2_spec_vtbl softtpm_vt2 = (tpm2_spec_vtbl){
+  softtpm_ctx_setalg,
+  softtpm_pcr_setalg,
+  NULL,
+  NULL,
+  softtpm_pcr_read_counter,
+  NULL
+};
+
+const pcr_vtbl softtpm_pcr_vtbl
+= (pcr_vtbl) {
+  "soft",
+  &softtpm_vt2,
+
+  softtpm_errout,
+  softtpm_ctx_init,
+  softtpm_ctx_uninit,
+  softtpm_ctx_freemem,
+  softtpm_pcr_read,
+  softtpm_pcr_extend,
+  softtpm_pcr_reset,
+  softtpm_pcr_read_multi,
+  softtpm_pcr_extend_multi,
+  softtpm_pcr_reset_multi
+};
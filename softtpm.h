@@ -0,0 +1,80 @@
+/* 
+ * softtpm.h
+ * A software tpm, keeping banks of pcrs in memory or in a state file.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _SOFTTPM_H_
+#define _SOFTTPM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include "tpm_common.h"
+
+/*
+ * A tpm2 of pcrs only, for tests and benchmarks to run without a tpm or
+ * a simulator. Banks of sha1, sha256, sha384 and sha512 are implemented,
+ * of which sha1 and sha256 are allocated at first, and a PCR_Allocate
+ * (pcr_setalg) takes effect at once, restarting the banks it changes.
+ * Pcrs start as a pc client tpm's do, with 17-22 of all ones, and only
+ * 16 and 23 could be reset, as from locality 0. pcrUpdateCounter counts
+ * extends of pcrs but 16 and 23, and changes of allocation.
+ *
+ * The state lives in memory, or in the file set by softtpm_set_state(),
+ * created if missing, to persist across invocations. The file is locked
+ * for every command, so it could be shared by several processes.
+ */
+
+#define SOFTTPM_BANKS 4
+
+// errors are numbered as the tpm2 ones of the same meaning.
+#define SOFTTPM_E_HASH 0x083 // TPM_RC_HASH, the algorithm is unknown.
+#define SOFTTPM_E_SIZE 0x095 // TPM_RC_SIZE, a digest of another size.
+#define SOFTTPM_E_VALUE 0x084 // TPM_RC_VALUE, no such pcr.
+#define SOFTTPM_E_LOCALITY 0x907 // TPM_RC_LOCALITY, not resettable.
+#define SOFTTPM_E_IO 0x50f70001 // the state file could not be used.
+
+extern const pcr_vtbl softtpm_pcr_vtbl;
+void softtpm_set_state(const char* path);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
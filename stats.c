@@ -0,0 +1,349 @@
+/* 
+ * stats.c
+ * Per-phase counts and latencies of a run, for --stats.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "stats.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct stats_samples {
+  size_t count;
+  size_t cap;
+  double* lat; // seconds of each sample.
+  double total;
+  uint64_t bytes;
+} stats_samples;
+
+static const char* const stats_names[STATS_PHASES] = {
+  "open",
+  "hash",
+  "tpm_init",
+  "tpm_uninit",
+  "tpm_read",
+  "tpm_read_multi",
+  "tpm_read_counter",
+  "tpm_extend",
+  "tpm_extend_multi",
+  "tpm_extend_async",
+  "tpm_finish",
+  "tpm_reset",
+  "tpm_reset_multi",
+  "tpm_setalg",
+  "tpm_quote",
+  "event_log",
+  "output",
+};
+
+static bool stats_on = false;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_samples stats_phases[STATS_PHASES];
+
+void stats_enable(void)
+{
+  stats_on = true;
+}
+
+bool stats_enabled(void)
+{
+  return stats_on;
+}
+
+double stats_now(void)
+{
+  struct timespec ts;
+  if(!stats_on)
+    return 0;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats_add(stats_phase phase, double start, uint64_t bytes)
+{
+  stats_samples* p = &stats_phases[phase];
+  double lat = 0;
+  if(!stats_on)
+    return;
+  lat = stats_now() - start;
+
+  pthread_mutex_lock(&stats_lock);
+  if(p->count == p->cap) {
+    size_t cap = p->cap? p->cap * 2: 64;
+    double* a = (double*)realloc(p->lat, cap * sizeof(double));
+    if(a != NULL) {
+      p->lat = a;
+      p->cap = cap;
+    }
+  }
+  // a sample without room is still counted, but not in percentiles.
+  if(p->count < p->cap)
+    p->lat[p->count] = lat;
+  p->count ++;
+  p->total += lat;
+  p->bytes += bytes;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * the decorator, whose functions record a sample for every call to the
+ * ones of stats_inner.
+ */
+
+static const pcr_vtbl* stats_inner = NULL;
+static pcr_vtbl stats_decorator;
+static tpm2_spec_vtbl stats_decorator2;
+
+static FP_tpm_errout(stats_errout)
+{
+  return stats_inner->errout(message, ret);
+}
+
+static FP_ctx_init(stats_ctx_init)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->ctx_init(ctx, stats_inner);
+  stats_add(STATS_TPM_INIT, start, 0);
+  return ret;
+}
+
+static FP_ctx_uninit(stats_ctx_uninit)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->ctx_uninit(ctx);
+  stats_add(STATS_TPM_UNINIT, start, 0);
+  return ret;
+}
+
+static FP_ctx_freemem(stats_ctx_freemem)
+{
+  stats_inner->ctx_freemem(ctx, ptr);
+}
+
+static FP_pcr_read(stats_pcr_read)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->pcr_read(ctx, pcr_index, pcrvalue);
+  stats_add(STATS_TPM_READ, start, 0);
+  return ret;
+}
+
+static FP_pcr_read_multi(stats_pcr_read_multi)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->pcr_read_multi(ctx, algs, nalg,
+					     pcr_mask, pcrvalues);
+  stats_add(STATS_TPM_READ_MULTI, start, 0);
+  return ret;
+}
+
+static FP_pcr_read_counter(stats_pcr_read_counter)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->vt2->pcr_read_counter(ctx, algs, nalg,
+						    pcr_mask, pcrvalues,
+						    counter);
+  stats_add(STATS_TPM_READ_COUNTER, start, 0);
+  return ret;
+}
+
+static FP_pcr_quote(stats_pcr_quote)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->vt2->pcr_quote(ctx, key_handle, algs, nalg,
+					     pcr_mask, nonce, nonce_len,
+					     quote);
+  stats_add(STATS_TPM_QUOTE, start, 0);
+  return ret;
+}
+
+static FP_pcr_extend(stats_pcr_extend)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->pcr_extend(ctx, pcr_index,
+					 data, datalen, newvalue);
+  stats_add(STATS_TPM_EXTEND, start, datalen);
+  return ret;
+}
+
+static FP_pcr_extend_multi(stats_pcr_extend_multi)
+{
+  double start = stats_now();
+  uint64_t bytes = 0;
+  size_t k = 0;
+  uint32_t ret = stats_inner->pcr_extend_multi(ctx, pcr_index, algs, nalg,
+					       data, datalen, newvalues);
+  for(; k < nalg; k++)
+    bytes += datalen[k];
+  stats_add(STATS_TPM_EXTEND_MULTI, start, bytes);
+  return ret;
+}
+
+static FP_pcr_reset(stats_pcr_reset)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->pcr_reset(ctx, pcr_index);
+  stats_add(STATS_TPM_RESET, start, 0);
+  return ret;
+}
+
+static FP_pcr_reset_multi(stats_pcr_reset_multi)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->pcr_reset_multi(ctx, pcr_mask);
+  stats_add(STATS_TPM_RESET_MULTI, start, 0);
+  return ret;
+}
+
+static FP_ctx_setalg(stats_ctx_setalg)
+{
+  stats_inner->vt2->ctx_setalg(ctx, alg);
+}
+
+static FP_pcr_setalg(stats_pcr_setalg)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->vt2->pcr_setalg(ctx, selection);
+  stats_add(STATS_TPM_SETALG, start, 0);
+  return ret;
+}
+
+static FP_pcr_extend_async(stats_pcr_extend_async)
+{
+  double start = stats_now();
+  uint64_t bytes = 0;
+  size_t k = 0;
+  uint32_t ret = stats_inner->vt2->pcr_extend_async(ctx, pcr_index,
+						    algs, nalg,
+						    data, datalen);
+  for(; k < nalg; k++)
+    bytes += datalen[k];
+  stats_add(STATS_TPM_EXTEND_ASYNC, start, bytes);
+  return ret;
+}
+
+static FP_pcr_finish(stats_pcr_finish)
+{
+  double start = stats_now();
+  uint32_t ret = stats_inner->vt2->pcr_finish(ctx);
+  stats_add(STATS_TPM_FINISH, start, 0);
+  return ret;
+}
+
+const pcr_vtbl* stats_vtbl(const pcr_vtbl* inner)
+{
+  stats_inner = inner;
+  stats_decorator = (pcr_vtbl) {
+    inner->tpm_version,
+    NULL,
+
+    stats_errout,
+    stats_ctx_init,
+    stats_ctx_uninit,
+    stats_ctx_freemem,
+    stats_pcr_read,
+    stats_pcr_extend,
+    stats_pcr_reset,
+    stats_pcr_read_multi,
+    stats_pcr_extend_multi,
+    stats_pcr_reset_multi
+  };
+  // optional entries stay missing, for wrappers to fall back as they do.
+  if(inner->vt2) {
+    stats_decorator2 = (tpm2_spec_vtbl) {
+      stats_ctx_setalg,
+      stats_pcr_setalg,
+      inner->vt2->pcr_extend_async? stats_pcr_extend_async: NULL,
+      inner->vt2->pcr_finish? stats_pcr_finish: NULL,
+      inner->vt2->pcr_read_counter? stats_pcr_read_counter: NULL,
+      inner->vt2->pcr_quote? stats_pcr_quote: NULL
+    };
+    stats_decorator.vt2 = &stats_decorator2;
+  }
+  return &stats_decorator;
+}
+
+static int stats_cmp(const void* a, const void* b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// the sample below which q of all samples are, nearest-rank.
+static double stats_quantile(const stats_samples* p, double q)
+{
+  size_t n = (p->count < p->cap)? p->count: p->cap;
+  size_t r = (size_t)(q * n + 0.999999);
+  if(n == 0)
+    return 0;
+  return p->lat[(r == 0)? 0: r - 1];
+}
+
+void stats_report(FILE* fp, bool json)
+{
+  size_t i = 0;
+  bool first = true;
+  pthread_mutex_lock(&stats_lock);
+  if(json)
+    fputs("{", fp);
+  else
+    fprintf(fp, "%-16s %8s %12s %10s %10s %10s %10s %10s\n",
+	    "phase", "count", "bytes", "total_ms",
+	    "min_ms", "p50_ms", "p99_ms", "max_ms");
+  for(; i < STATS_PHASES; i++) {
+    stats_samples* p = &stats_phases[i];
+    size_t n = (p->count < p->cap)? p->count: p->cap;
+    if(p->count == 0)
+      continue;
+    qsort(p->lat, n, sizeof(double), stats_cmp);
+    double min = n? p->lat[0]: 0;
+    double max = n? p->lat[n - 1]: 0;
+    double p50 = stats_quantile(p, 0.5);
+    double p99 = stats_quantile(p, 0.99);
+    if(json)
+      fprintf(fp, "%s\"%s\":{\"count\":%zu,\"bytes\":%llu,"
+	      "\"total_ms\":%.3f,\"min_ms\":%.3f,\"p50_ms\":%.3f,"
+	      "\"p99_ms\":%.3f,\"max_ms\":%.3f}",
+	      first? "": ",", stats_names[i], p->count,
+	      (unsigned long long)p->bytes, p->total * 1e3,
+	      min * 1e3, p50 * 1e3, p99 * 1e3, max * 1e3);
+    else
+      fprintf(fp, "%-16s %8zu %12llu %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+	      stats_names[i], p->count, (unsigned long long)p->bytes,
+	      p->total * 1e3, min * 1e3, p50 * 1e3, p99 * 1e3, max * 1e3);
+    first = false;
+  }
+  if(json)
+    fputs("}\n", fp);
+  pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,96 @@
+/* 
+ * stats.h
+ * Per-phase counts and latencies of a run, for --stats.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include "tpm_common.h"
+
+typedef enum stats_phase {
+  STATS_OPEN = 0,
+  STATS_HASH,
+  STATS_TPM_INIT,
+  STATS_TPM_UNINIT,
+  STATS_TPM_READ,
+  STATS_TPM_READ_MULTI,
+  STATS_TPM_READ_COUNTER,
+  STATS_TPM_EXTEND,
+  STATS_TPM_EXTEND_MULTI,
+  STATS_TPM_EXTEND_ASYNC,
+  STATS_TPM_FINISH,
+  STATS_TPM_RESET,
+  STATS_TPM_RESET_MULTI,
+  STATS_TPM_SETALG,
+  STATS_TPM_QUOTE,
+  STATS_EVENTLOG,
+  STATS_OUTPUT,
+  STATS_PHASES
+} stats_phase;
+
+/*
+ * nothing is recorded until stats_enable(), so stats_now() and
+ * stats_add() cost next to nothing in runs without --stats. samples
+ * may be added by several threads at once.
+ */
+void stats_enable(void);
+bool stats_enabled(void);
+double stats_now(void);
+// a sample of the phase from start (of stats_now()) till now.
+void stats_add(stats_phase phase, double start, uint64_t bytes);
+
+/*
+ * a vtbl calling the one of ctx, recording a sample for every call, to
+ * replace ctx->vtbl with once initialized. there is one such vtbl, so
+ * only one context could be decorated at a time.
+ */
+const pcr_vtbl* stats_vtbl(const pcr_vtbl* inner);
+
+// count, bytes and min/p50/p99/max latency of every phase sampled.
+void stats_report(FILE* fp, bool json);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
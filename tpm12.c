@@ -33,15 +33,136 @@
  */
 
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include "tpm12.h"
+#include "tpm12_timeout.h"
+
+static unsigned tpm12_timeout = TPM12_DEFAULT_TIMEOUT;
+
+void tpm12_set_timeout(unsigned ms)
+{
+  tpm12_timeout = ms;
+}
 
 static FP_tpm_errout(tpm12_errout)
 {
   fprintf(stderr, "%s returned 0x%08x. %s.\n",
-	  message, ret, (const char *)Trspi_Error_String(ret));
+	  message, ret,
+	  (ret == TPM12_E_TIMEOUT)? "tcsd did not answer in time":
+	  (const char *)Trspi_Error_String(ret));
   return ret;
 }
 
+typedef struct tpm12_connecting {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  TSS_HCONTEXT ctx;
+  TSS_RESULT r;
+  bool done;
+  bool abandoned; // by the caller timed out, for the thread to free.
+} tpm12_connecting;
+
+static void* tpm12_connect_run(void* arg)
+{
+  tpm12_connecting* c = (tpm12_connecting*)arg;
+  TSS_RESULT r = Tspi_Context_Connect(c->ctx, NULL);
+  bool abandoned = false;
+  pthread_mutex_lock(&c->lock);
+  c->r = r;
+  c->done = true;
+  abandoned = c->abandoned;
+  pthread_cond_signal(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+  if(abandoned)
+    free(c);
+  return NULL;
+}
+
+// the sockets open, as a bitmap of fds below 1024.
+#define TPM12_MAX_FD 1024
+static void tpm12_sockets(uint64_t* map)
+{
+  int fd = 0;
+  memset(map, 0, TPM12_MAX_FD / 8);
+  for(; fd < TPM12_MAX_FD; fd++) {
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode))
+      map[fd / 64] |= 1ull << (fd % 64);
+  }
+}
+
+/*
+ * connect on a thread, waited for up to tpm12_timeout. the socket the TSS
+ * opens to tcsd, found as the one not open before, gets the timeout for
+ * sends and receives of commands after.
+ */
+static TSS_RESULT tpm12_connect(TSS_HCONTEXT ctx)
+{
+  uint64_t before[TPM12_MAX_FD / 64];
+  uint64_t after[TPM12_MAX_FD / 64];
+  struct timespec deadline;
+  pthread_condattr_t attr;
+  struct timeval tv = {tpm12_timeout / 1000, (tpm12_timeout % 1000) * 1000};
+  tpm12_connecting* c = NULL;
+  pthread_t thread;
+  TSS_RESULT r = TSS_SUCCESS;
+  int fd = 0;
+
+  if(tpm12_timeout == 0)
+    return Tspi_Context_Connect(ctx, NULL);
+
+  c = (tpm12_connecting*)calloc(1, sizeof(*c));
+  if(c == NULL)
+    return TSS_LAYER_TSP | TSS_E_OUTOFMEMORY;
+  pthread_mutex_init(&c->lock, NULL);
+  // the clock may be stepped (e.g. by ntp at boot) while waiting.
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&c->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  c->ctx = ctx;
+  tpm12_sockets(before);
+  if(pthread_create(&thread, NULL, tpm12_connect_run, c) != 0) {
+    free(c);
+    return TSS_LAYER_TSP | TSS_E_INTERNAL_ERROR;
+  }
+  pthread_detach(thread);
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += tpm12_timeout / 1000;
+  deadline.tv_nsec += (tpm12_timeout % 1000) * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec ++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  pthread_mutex_lock(&c->lock);
+  while(!c->done
+	&& pthread_cond_timedwait(&c->cond, &c->lock, &deadline) != ETIMEDOUT);
+  if(!c->done) {
+    c->abandoned = true;
+    pthread_mutex_unlock(&c->lock);
+    return TPM12_E_TIMEOUT;
+  }
+  r = c->r;
+  pthread_mutex_unlock(&c->lock);
+  free(c);
+
+  tpm12_sockets(after);
+  for(; fd < TPM12_MAX_FD && r == TSS_SUCCESS; fd++) {
+    if((after[fd / 64] & ~before[fd / 64]) & (1ull << (fd % 64))) {
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+  }
+  return r;
+}
+
 //TSS_RESULT tss_basic_handle_init(TSS_BASIC_HANDLES* hdls)
 
 static FP_ctx_init(tpm12_ctx_init)
@@ -53,8 +174,12 @@ static FP_ctx_init(tpm12_ctx_init)
   if (r != TSS_SUCCESS)
     return r;
   
-  r = tpm12_errout("Context Connect",
-		   Tspi_Context_Connect(ctx1->ctx, NULL));
+  r = tpm12_errout("Context Connect", tpm12_connect(ctx1->ctx));
+  if (r == TPM12_E_TIMEOUT) {
+    // still in use by the connecting thread, left as it is.
+    ctx1->ctx = 0;
+    return r;
+  }
   if (r != TSS_SUCCESS)
     return r;
   
@@ -67,6 +192,8 @@ static FP_ctx_uninit(tpm12_ctx_uninit)
 {
   tpm12_pcr_context* ctx1 = (tpm12_pcr_context*)ctx;
   TSS_RESULT r = TSS_SUCCESS;
+  if (ctx1->ctx == 0)
+    return r;
   
   r = tpm12_errout("Free CTX-binded memories", Tspi_Context_FreeMemory(ctx1->ctx, NULL));
   if (r != TSS_SUCCESS)
@@ -130,7 +257,9 @@ static FP_pcr_extend(tpm12_pcr_extend)
 				    &event,
 				    &l,
 				    (BYTE**)&v);
+  // the new value comes with the response anyway.
   if((TSS_SUCCESS == ret)
+     && (newvalue != NULL)
      && (l == TPM1_PCR_SIZE)) {
     memcpy(newvalue->a, v, TPM1_PCR_SIZE);
     newvalue->s = TPM1_PCR_SIZE;
@@ -143,18 +272,24 @@ static FP_pcr_extend(tpm12_pcr_extend)
   return ret;
 }
 
-//TSS_RESULT resetpcr(TSS_BASIC_HANDLES hdls, uint32_t pcr_index)
-static FP_pcr_reset(tpm12_pcr_reset)
+/*
+ * all pcrs selected in one composite are reset by one TPM_PCR_Reset.
+ */
+static FP_pcr_reset_multi(tpm12_pcr_reset_multi)
 {
   tpm12_pcr_context* ctx1 = (tpm12_pcr_context*)ctx;
   TSS_HANDLE pcr_composite = 0;
   TSS_RESULT r = TSS_SUCCESS;
+  uint32_t i = 0;
   r = Tspi_Context_CreateObject(ctx1->ctx, TSS_OBJECT_TYPE_PCRS,
 			       0, &pcr_composite);
   if(r != TSS_SUCCESS)
     return r;
   do {
-    r = Tspi_PcrComposite_SelectPcrIndex(pcr_composite, pcr_index);
+    for(; i < PCR_NUM && r == TSS_SUCCESS; i++) {
+      if(pcr_mask & (1u << i))
+	r = Tspi_PcrComposite_SelectPcrIndex(pcr_composite, i);
+    }
     if(r != TSS_SUCCESS)
       break;
     
@@ -166,6 +301,37 @@ static FP_pcr_reset(tpm12_pcr_reset)
   return (rclose == TSS_SUCCESS)?r:rclose;
 }
 
+//TSS_RESULT resetpcr(TSS_BASIC_HANDLES hdls, uint32_t pcr_index)
+static FP_pcr_reset(tpm12_pcr_reset)
+{
+  return tpm12_pcr_reset_multi(ctx, 1u << pcr_index);
+}
+
+/*
+ * Tspi reads one pcr per call anyway, there is only one bank to read.
+ */
+static FP_pcr_read_multi(tpm12_pcr_read_multi)
+{
+  uint32_t ret = TSS_SUCCESS;
+  uint32_t i = 0;
+  if(nalg != 1)
+    return TSS_E_BAD_PARAMETER;
+
+  for(; i < PCR_NUM && ret == TSS_SUCCESS; i++) {
+    pcrvalues[i].s = 0;
+    if(pcr_mask & (1u << i))
+      ret = tpm12_pcr_read(ctx, i, &pcrvalues[i]);
+  }
+  return ret;
+}
+
+static FP_pcr_extend_multi(tpm12_pcr_extend_multi)
+{
+  if(nalg != 1)
+    return TSS_E_BAD_PARAMETER;
+  return tpm12_pcr_extend(ctx, pcr_index, data, datalen[0], newvalues);
+}
+
 const pcr_vtbl tpm12_pcr_vtbl
 = (pcr_vtbl) {
   "1.2",
@@ -177,5 +343,8 @@ const pcr_vtbl tpm12_pcr_vtbl
   tpm12_ctx_freemem,
   tpm12_pcr_read,
   tpm12_pcr_extend,
-  tpm12_pcr_reset
+  tpm12_pcr_reset,
+  tpm12_pcr_read_multi,
+  tpm12_pcr_extend_multi,
+  tpm12_pcr_reset_multi
 };
@@ -0,0 +1,67 @@
+/* 
+ * tpm12_timeout.h
+ * Deadline of connecting to tcsd, exported without headers of the TSS.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _TPM12_TIMEOUT_H_
+#define _TPM12_TIMEOUT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+/*
+ * Tspi_Context_Connect waits for tcsd as long as it takes, which is for
+ * ever if tcsd is hung. It is run on a thread of its own, to be given up
+ * after a deadline with TPM12_E_TIMEOUT, which leaves that thread and
+ * its context behind; and commands on the connection made are bounded by
+ * the same deadline, with timeouts of its socket, failing with the
+ * communication error of the TSS.
+ */
+
+#define TPM12_DEFAULT_TIMEOUT 5000 // in milliseconds.
+#define TPM12_E_TIMEOUT 0x70c10001 // tcsd did not answer in time.
+
+// 0 waits for ever, as Tspi does.
+void tpm12_set_timeout(unsigned ms);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
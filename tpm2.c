@@ -223,12 +223,16 @@ static FP_ctx_init(tpm2_ctx_init)
     }
 
     ctx2->ctx = sysctx;
+    ctx2->next = NULL;
+    ctx2->pending = false;
     
   } while(0);
 
   return ret;  
 }
 
+static FP_pcr_finish(tpm2_pcr_finish);
+
 static FP_ctx_uninit(tpm2_ctx_uninit)
 {
   tpm2_pcr_context* ctx2 = (tpm2_pcr_context*)ctx;
@@ -236,6 +240,13 @@ static FP_ctx_uninit(tpm2_ctx_uninit)
   TSS2_RC ret = TSS2_RC_SUCCESS;
   TSS2_TCTI_CONTEXT* vtbl = NULL;
 
+  // the tcti must not be freed with a response left to be received.
+  tpm2_pcr_finish(ctx);
+  if(ctx2->next) {
+    Tss2_Sys_Finalize(ctx2->next);
+    free(ctx2->next);
+    ctx2->next = NULL;
+  }
   Tss2_Sys_GetTctiContext(ctx2->ctx, &vtbl);
   Tss2_Sys_Finalize(ctx2->ctx);
   free(ctx2->ctx);
@@ -305,6 +316,126 @@ static FP_pcr_read(tpm2_pcr_read)
   
 }
 
+static bool tpm2_selection_isempty(const TPML_PCR_SELECTION* sel)
+{
+  size_t k = 0;
+  for(; k < sel->count; k++) {
+    size_t j = 0;
+    for(; j < sel->pcrSelections[k].sizeofSelect; j++)
+      if(sel->pcrSelections[k].pcrSelect[j] != 0)
+	return false;
+  }
+  return true;
+}
+
+/*
+ * A single PCR_Read returns no more digests than a TPML_DIGEST holds (8),
+ * and reports in pcrSelectionOut which of the selected pcrs it did read,
+ * banks in the order given and pcrs in ascending order. Selecting all the
+ * pcrs wanted on all banks at once, and removing the ones read from the
+ * selection, reads them in as few round trips as the tpm allows.
+ *
+ * When the counter is asked for, a read of several round trips is started
+ * over if the counter moves in between, so all values are of one counter.
+ */
+static FP_pcr_read_counter(tpm2_pcr_read_counter)
+{
+  tpm2_pcr_context* ctx2 = (tpm2_pcr_context*)ctx;
+  TSS2_RC ret = TSS2_RC_SUCCESS;
+
+  TPML_DIGEST pcrValues;
+  TPML_PCR_SELECTION pcrSelection, pcrSelectionOut;
+  UINT32 pcrUpdateCounter = 0;
+  size_t tries = 0;
+  bool moved = false;
+
+  if(nalg > HASH_COUNT || (nalg == 0 && (pcr_mask != 0 || counter == NULL)))
+    return TSS2_BASE_RC_BAD_VALUE;
+
+  do {
+    // the counter alone is read by a command selecting no pcr.
+    bool once = (pcr_mask == 0);
+    bool first = true;
+    size_t k = 0;
+
+    moved = false;
+    pcrSelection.count = nalg;
+    for(; k < nalg; k++) {
+      size_t i = 0;
+      pcrSelection.pcrSelections[k].hash = algs[k];
+      SETSZ_PCR_SELECT(pcrSelection.pcrSelections[k],
+		       sizeof(pcrSelection.pcrSelections[k].pcrSelect));
+      CLRB_PCR_SELECT(pcrSelection.pcrSelections[k]);
+      for(; i < PCR_NUM; i++) {
+	pcrvalues[k * PCR_NUM + i].s = 0;
+	if(pcr_mask & (1u << i))
+	  SETB_PCR_SELECT(pcrSelection.pcrSelections[k], i);
+      }
+    }
+
+    while(once || !tpm2_selection_isempty(&pcrSelection)) {
+      size_t got = 0;
+      size_t d = 0;
+      size_t j = 0;
+
+      once = false;
+      ret = Tss2_Sys_PCR_Read(ctx2->ctx,
+			      0,
+			      &pcrSelection,
+			      &pcrUpdateCounter,
+			      &pcrSelectionOut,
+			      &pcrValues,
+			      0);
+      if(ret != TSS2_RC_SUCCESS)
+	break;
+      if(counter != NULL) {
+	if(!first && *counter != pcrUpdateCounter) {
+	  moved = true;
+	  break;
+	}
+	*counter = pcrUpdateCounter;
+      }
+      first = false;
+
+      for(; j < pcrSelectionOut.count; j++) {
+	TPMS_PCR_SELECTION* out = &pcrSelectionOut.pcrSelections[j];
+	size_t i = 0;
+	for(k = 0; k < nalg && algs[k] != out->hash; k++);
+	for(; i < out->sizeofSelect * 8u && d < pcrValues.count; i++) {
+	  if(!(out->pcrSelect[i / 8] & (1 << (i % 8))))
+	    continue;
+	  if(k < nalg && i < PCR_NUM
+	     && pcrValues.digests[d].t.size <= sizeof(pcrvalues->a)) {
+	    pcr* v = &pcrvalues[k * PCR_NUM + i];
+	    memcpy(v->a, pcrValues.digests[d].t.buffer,
+		   pcrValues.digests[d].t.size);
+	    v->s = pcrValues.digests[d].t.size;
+	    pcrSelection.pcrSelections[k].pcrSelect[i / 8] &= ~(1 << (i % 8));
+	    got ++;
+	  }
+	  d ++;
+	}
+      }
+
+      // nothing more is read, the rest are not allocated on their banks.
+      if(got == 0)
+	break;
+    }
+  } while(moved && ++ tries < 3);
+
+  // pcrs are extended faster than they could be read.
+  if(moved)
+    ret = TSS2_BASE_RC_TRY_AGAIN;
+  return ret;
+}
+
+static FP_pcr_read_multi(tpm2_pcr_read_multi)
+{
+  if(nalg == 0)
+    return TSS2_BASE_RC_BAD_VALUE;
+  return tpm2_pcr_read_counter(ctx, algs, nalg, pcr_mask, pcrvalues, NULL);
+}
+
 static FP_pcr_extend(tpm2_pcr_extend)
 {
   tpm2_pcr_context* ctx2 = (tpm2_pcr_context*)ctx;
@@ -330,7 +461,7 @@ static FP_pcr_extend(tpm2_pcr_extend)
     memcpy(&(digests.digests[0].digest), data, datalen);
 
     ret = Tss2_Sys_PCR_Extend(ctx2->ctx, pcr_index, &sessionsData, &digests, 0);
-    if(ret != TSS2_RC_SUCCESS) {
+    if(ret != TSS2_RC_SUCCESS || newvalue == NULL) {
       break;
     }
 
@@ -340,9 +471,158 @@ static FP_pcr_extend(tpm2_pcr_extend)
   return ret;
 }
 
-static FP_pcr_reset(tpm2_pcr_reset)
+static bool tpm2_digest_values(TPML_DIGEST_VALUES* digests,
+			       const uint32_t* algs, size_t nalg,
+			       const char* data, const uint32_t* datalen)
+{
+  size_t k = 0;
+  if(nalg == 0 || nalg > HASH_COUNT)
+    return false;
+  digests->count = nalg;
+  for(; k < nalg; data += datalen[k], k++) {
+    if(datalen[k] > sizeof(digests->digests[k].digest))
+      return false;
+    digests->digests[k].hashAlg = algs[k];
+    memcpy(&(digests->digests[k].digest), data, datalen[k]);
+  }
+  return true;
+}
+
+/*
+ * all banks are extended with one TPML_DIGEST_VALUES under one auth
+ * session, and read back with one batched read.
+ */
+static FP_pcr_extend_multi(tpm2_pcr_extend_multi)
+{
+  tpm2_pcr_context* ctx2 = (tpm2_pcr_context*)ctx;
+  TSS2_RC ret = TSS2_RC_SUCCESS;
+
+  TPMS_AUTH_COMMAND sessionData, *sessionDataptr = &sessionData;
+  TSS2_SYS_CMD_AUTHS sessionsData;
+  TPML_DIGEST_VALUES digests;
+  size_t k = 0;
+
+  sessionsData.cmdAuths = &sessionDataptr;
+  sessionData.sessionHandle = TPM_RS_PW;
+  sessionData.nonce.t.size = 0;
+  sessionData.hmac.t.size = 0;
+  *( (UINT8 *)((void *)&sessionData.sessionAttributes ) ) = 0;
+  sessionsData.cmdAuthsCount = 1;
+  sessionsData.cmdAuths[0] = &sessionData;
+
+  if(!tpm2_digest_values(&digests, algs, nalg, data, datalen))
+    return TSS2_BASE_RC_BAD_VALUE;
+
+  do {
+    ret = Tss2_Sys_PCR_Extend(ctx2->ctx, pcr_index, &sessionsData, &digests, 0);
+    if(ret != TSS2_RC_SUCCESS || newvalues == NULL) {
+      break;
+    }
+
+    pcr values[nalg * PCR_NUM];
+    ret = tpm2_pcr_read_multi(ctx, algs, nalg, 1u << pcr_index, values);
+    for(k = 0; k < nalg; k++)
+      newvalues[k] = values[k * PCR_NUM + pcr_index];
+  } while(0);
+
+  return ret;
+}
+
+/*
+ * The SAPI splits a command into marshaling it (_Prepare), sending it
+ * (ExecuteAsync), receiving its response (ExecuteFinish) and unmarshaling
+ * that (_Complete), so the caller can go on (hashing the next file, say)
+ * while the tpm executes the extend. The next extend is marshaled in the
+ * other context before waiting for the one in flight, and sent right after
+ * it completes, then the two contexts swap.
+ */
+static FP_pcr_finish(tpm2_pcr_finish)
+{
+  tpm2_pcr_context* ctx2 = (tpm2_pcr_context*)ctx;
+  TSS2_RC ret = TSS2_RC_SUCCESS;
+
+  if(!ctx2->pending)
+    return ret;
+  ctx2->pending = false;
+  ret = Tss2_Sys_ExecuteFinish(ctx2->ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+  if(ret == TSS2_RC_SUCCESS)
+    ret = Tss2_Sys_PCR_Extend_Complete(ctx2->ctx);
+  return ret;
+}
+
+static FP_pcr_extend_async(tpm2_pcr_extend_async)
+{
+  tpm2_pcr_context* ctx2 = (tpm2_pcr_context*)ctx;
+  TSS2_RC ret = TSS2_RC_SUCCESS;
+
+  TPMS_AUTH_COMMAND sessionData, *sessionDataptr = &sessionData;
+  TSS2_SYS_CMD_AUTHS sessionsData;
+  TPML_DIGEST_VALUES digests;
+
+  sessionsData.cmdAuths = &sessionDataptr;
+  sessionData.sessionHandle = TPM_RS_PW;
+  sessionData.nonce.t.size = 0;
+  sessionData.hmac.t.size = 0;
+  *( (UINT8 *)((void *)&sessionData.sessionAttributes ) ) = 0;
+  sessionsData.cmdAuthsCount = 1;
+  sessionsData.cmdAuths[0] = &sessionData;
+
+  if(!tpm2_digest_values(&digests, algs, nalg, data, datalen))
+    return TSS2_BASE_RC_BAD_VALUE;
+
+  do {
+    if(ctx2->next == NULL) {
+      size_t sysctx_size = Tss2_Sys_GetContextSize(0);
+      TSS2_TCTI_CONTEXT* tcti_vtbl = NULL;
+      TSS2_SYS_CONTEXT* sysctx = (TSS2_SYS_CONTEXT*)calloc(1, sysctx_size);
+      if(sysctx == NULL) {
+	ret = TSS2_BASE_RC_GENERAL_FAILURE;
+	break;
+      }
+      Tss2_Sys_GetTctiContext(ctx2->ctx, &tcti_vtbl);
+      ret = Tss2_Sys_Initialize(sysctx, sysctx_size, tcti_vtbl,
+				(TSS2_ABI_VERSION*)&abiver);
+      if(ret != TSS2_RC_SUCCESS) {
+	free(sysctx);
+	break;
+      }
+      ctx2->next = sysctx;
+    }
+
+    ret = Tss2_Sys_PCR_Extend_Prepare(ctx2->next, pcr_index, &digests);
+    if(ret != TSS2_RC_SUCCESS)
+      break;
+    ret = Tss2_Sys_SetCmdAuths(ctx2->next, &sessionsData);
+    if(ret != TSS2_RC_SUCCESS)
+      break;
+
+    ret = tpm2_pcr_finish(ctx);
+    if(ret != TSS2_RC_SUCCESS)
+      break;
+
+    ret = Tss2_Sys_ExecuteAsync(ctx2->next);
+    if(ret != TSS2_RC_SUCCESS)
+      break;
+    {
+      TSS2_SYS_CONTEXT* sent = ctx2->next;
+      ctx2->next = ctx2->ctx;
+      ctx2->ctx = sent;
+      ctx2->pending = true;
+    }
+  } while(0);
+
+  return ret;
+}
+
+/*
+ * PCR_Reset takes one pcr, so pcrs are reset one after another, with the
+ * same password session.
+ */
+static FP_pcr_reset_multi(tpm2_pcr_reset_multi)
 {
   tpm2_pcr_context* ctx2 = (tpm2_pcr_context*)ctx;
+  TSS2_RC ret = TSS2_RC_SUCCESS;
+  uint32_t i = 0;
   TPMS_AUTH_COMMAND sessionData, *sessionDataPtr = &sessionData;
   TPMS_AUTH_RESPONSE sessionDataOut, *sessionDataOutPtr = &sessionDataOut;
   TSS2_SYS_CMD_AUTHS sessionsData;
@@ -368,10 +648,125 @@ static FP_pcr_reset(tpm2_pcr_reset)
   sessionsData.cmdAuthsCount = 1;
   sessionsData.cmdAuths[0] = &sessionData;
 
-  return Tss2_Sys_PCR_Reset(ctx2->ctx,
-			    pcr_index,
-			    &sessionsData,
-			    &sessionsDataOut);
+  for(; i < PCR_NUM && ret == TSS2_RC_SUCCESS; i++) {
+    if(pcr_mask & (1u << i))
+      ret = Tss2_Sys_PCR_Reset(ctx2->ctx,
+			       i,
+			       &sessionsData,
+			       &sessionsDataOut);
+  }
+  return ret;
+}
+
+static FP_pcr_reset(tpm2_pcr_reset)
+{
+  return tpm2_pcr_reset_multi(ctx, 1u << pcr_index);
+}
+
+/*
+ * the key is expected loaded already (e.g. a persistent one), so that it
+ * is used by quotes one after another without loading it again. inScheme
+ * is TPM_ALG_NULL for the scheme of the key to be used.
+ */
+static FP_pcr_quote(tpm2_pcr_quote)
+{
+  tpm2_pcr_context* ctx2 = (tpm2_pcr_context*)ctx;
+  TSS2_RC ret = TSS2_RC_SUCCESS;
+
+  TPMS_AUTH_COMMAND sessionData, *sessionDataPtr = &sessionData;
+  TPMS_AUTH_RESPONSE sessionDataOut, *sessionDataOutPtr = &sessionDataOut;
+  TSS2_SYS_CMD_AUTHS sessionsData;
+  TSS2_SYS_RSP_AUTHS sessionsDataOut;
+  TPM2B_DATA qualifyingData;
+  TPMT_SIG_SCHEME inScheme;
+  TPML_PCR_SELECTION pcrSelection;
+  TPM2B_ATTEST quoted;
+  TPMT_SIGNATURE signature;
+  size_t k = 0;
+
+  if(nalg == 0 || nalg > HASH_COUNT
+     || nonce_len > sizeof(qualifyingData.t.buffer))
+    return TSS2_BASE_RC_BAD_VALUE;
+
+  sessionsDataOut.rspAuths = &sessionDataOutPtr;
+  sessionsData.cmdAuths = &sessionDataPtr;
+  sessionsDataOut.rspAuthsCount = 1;
+  sessionData.sessionHandle = TPM_RS_PW;
+  sessionData.nonce.t.size = 0;
+  sessionData.hmac.t.size = 0;
+  *( (UINT8 *)((void *)&sessionData.sessionAttributes ) ) = 0;
+  sessionsData.cmdAuthsCount = 1;
+  sessionsData.cmdAuths[0] = &sessionData;
+
+  qualifyingData.t.size = nonce_len;
+  memcpy(qualifyingData.t.buffer, nonce, nonce_len);
+  inScheme.scheme = TPM_ALG_NULL;
+
+  pcrSelection.count = nalg;
+  for(; k < nalg; k++) {
+    size_t i = 0;
+    pcrSelection.pcrSelections[k].hash = algs[k];
+    SETSZ_PCR_SELECT(pcrSelection.pcrSelections[k],
+		     sizeof(pcrSelection.pcrSelections[k].pcrSelect));
+    CLRB_PCR_SELECT(pcrSelection.pcrSelections[k]);
+    for(; i < PCR_NUM; i++) {
+      if(pcr_mask & (1u << i))
+	SETB_PCR_SELECT(pcrSelection.pcrSelections[k], i);
+    }
+  }
+  quoted.t.size = sizeof(quoted.t.attestationData);
+
+  ret = Tss2_Sys_Quote(ctx2->ctx,
+		       key_handle,
+		       &sessionsData,
+		       &qualifyingData,
+		       &inScheme,
+		       &pcrSelection,
+		       &quoted,
+		       &signature,
+		       &sessionsDataOut);
+  if(ret != TSS2_RC_SUCCESS)
+    return ret;
+
+  if(quoted.t.size > sizeof(quote->attest))
+    return TSS2_BASE_RC_INSUFFICIENT_BUFFER;
+  quote->attest_size = quoted.t.size;
+  memcpy(quote->attest, quoted.t.attestationData, quoted.t.size);
+  quote->sig_alg = signature.sigAlg;
+
+  switch(signature.sigAlg) {
+  case TPM_ALG_RSASSA:
+  case TPM_ALG_RSAPSS:
+    {
+      // rsassa and rsapss signatures are of the same form.
+      TPMS_SIGNATURE_RSA* rsa = &signature.signature.rsassa;
+      if(rsa->sig.t.size > sizeof(quote->sig))
+	return TSS2_BASE_RC_INSUFFICIENT_BUFFER;
+      quote->hash_alg = rsa->hash;
+      quote->sig_size = rsa->sig.t.size;
+      memcpy(quote->sig, rsa->sig.t.buffer, rsa->sig.t.size);
+    }
+    break;
+  case TPM_ALG_ECDSA:
+    {
+      // r and s are padded to the same size, which is of the curve.
+      TPMS_SIGNATURE_ECC* ecc = &signature.signature.ecdsa;
+      size_t rs = ecc->signatureR.t.size;
+      size_t ss = ecc->signatureS.t.size;
+      size_t half = (rs > ss)? rs: ss;
+      if(2 * half > sizeof(quote->sig))
+	return TSS2_BASE_RC_INSUFFICIENT_BUFFER;
+      quote->hash_alg = ecc->hash;
+      quote->sig_size = 2 * half;
+      memset(quote->sig, 0, 2 * half);
+      memcpy(quote->sig + half - rs, ecc->signatureR.t.buffer, rs);
+      memcpy(quote->sig + 2 * half - ss, ecc->signatureS.t.buffer, ss);
+    }
+    break;
+  default:
+    ret = TSS2_BASE_RC_NOT_IMPLEMENTED;
+  }
+  return ret;
 }
 
 static FP_pcr_setalg(tpm2_pcr_setalg)
@@ -436,7 +831,11 @@ static FP_ctx_setalg(tpm2_ctx_setalg)
 
 static const tpm2_spec_vtbl vt2 = (tpm2_spec_vtbl){
   tpm2_ctx_setalg,
-  tpm2_pcr_setalg
+  tpm2_pcr_setalg,
+  tpm2_pcr_extend_async,
+  tpm2_pcr_finish,
+  tpm2_pcr_read_counter,
+  tpm2_pcr_quote
 };
 
 const pcr_vtbl tpm2_pcr_vtbl
@@ -450,5 +849,8 @@ const pcr_vtbl tpm2_pcr_vtbl
   tpm2_ctx_freemem,
   tpm2_pcr_read,
   tpm2_pcr_extend,
-  tpm2_pcr_reset
+  tpm2_pcr_reset,
+  tpm2_pcr_read_multi,
+  tpm2_pcr_extend_multi,
+  tpm2_pcr_reset_multi
 };
@@ -53,6 +53,10 @@ typedef struct tpm2_pcr_context {
     struct {
       TSS2_SYS_CONTEXT* ctx;
       TPMI_ALG_HASH alg;
+      // a second context over the same tcti, in which the next command is
+      // marshaled while the one sent with ctx is in flight, when pending.
+      TSS2_SYS_CONTEXT* next;
+      bool pending;
     };
   };
 } tpm2_pcr_context;
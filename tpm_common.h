@@ -49,6 +49,7 @@ extern "C" {
 #endif
 
 #define PCRSIZE 64 //size of digest of sha512, the largest one.
+#define PCR_NUM 24 //pcrs in a bank.
 
 typedef struct pcr {
   char s;
@@ -56,6 +57,9 @@ typedef struct pcr {
 } pcr;
 
 int fprintpcr(FILE* fp, uint32_t pcr_index, const pcr* pcr_content);
+// print the name of bank between index and value, as "PCR 16:sha256:..".
+int fprintpcr_bank(FILE* fp, uint32_t pcr_index, const char* bank,
+		   const pcr* pcr_content);
 
 typedef struct pcr_vtbl pcr_vtbl;
 typedef struct tpm2_spec_vtbl tpm2_spec_vtbl;
@@ -95,7 +99,7 @@ typedef FP_tpm_errout(fp_tpm_errout);
 typedef struct pcr_context_base {
   const pcr_vtbl* vtbl;
   union {
-    uintptr_t privdata[2];
+    uintptr_t privdata[4];
   };
 } pcr_context_base;
 
@@ -115,6 +119,19 @@ typedef FP_ctx_freemem(fp_ctx_freemem);
 				    pcr* pcrvalue)
 typedef FP_pcr_read(fp_pcr_read);
 
+/*
+ * read the pcrs whose bits are set in pcr_mask, on each bank of algs
+ * (ids of tpm2, ignored by tpm1, which has only one bank), into
+ * pcrvalues[k * PCR_NUM + index] for the kth bank. pcrs unavailable on a
+ * bank are left with a size of 0.
+ */
+#define FP_pcr_read_multi(x) uint32_t (x)(pcr_context_base* ctx, \
+					  const uint32_t* algs,	   \
+					  size_t nalg,		   \
+					  uint32_t pcr_mask,	   \
+					  pcr* pcrvalues)
+typedef FP_pcr_read_multi(fp_pcr_read_multi);
+
 #define FP_pcr_extend(x) uint32_t (x)(pcr_context_base* ctx, \
 				      uint32_t pcr_index,    \
 				      const char* data,	     \
@@ -122,10 +139,33 @@ typedef FP_pcr_read(fp_pcr_read);
 				      pcr* newvalue)
 typedef FP_pcr_extend(fp_pcr_extend);
 
+/*
+ * extend a pcr on each bank of algs (as pcr_read_multi takes them) in one
+ * command, data holds the digest for each bank one after another, of
+ * datalen[k] bytes, and new values of banks are read into newvalues[k].
+ * for both extends, the new value is not read if newvalue(s) is NULL.
+ */
+#define FP_pcr_extend_multi(x) uint32_t (x)(pcr_context_base* ctx, \
+					    uint32_t pcr_index,	     \
+					    const uint32_t* algs,    \
+					    size_t nalg,	     \
+					    const char* data,	     \
+					    const uint32_t* datalen, \
+					    pcr* newvalues)
+typedef FP_pcr_extend_multi(fp_pcr_extend_multi);
+
 #define FP_pcr_reset(x) uint32_t (x)(pcr_context_base* ctx, \
 				     uint32_t pcr_index)
 typedef FP_pcr_reset(fp_pcr_reset);
 
+/*
+ * reset the pcrs of pcr_mask (on every bank of tpm2) in as few commands as
+ * the tpm takes, stopping at the first one failing.
+ */
+#define FP_pcr_reset_multi(x) uint32_t (x)(pcr_context_base* ctx, \
+					   uint32_t pcr_mask)
+typedef FP_pcr_reset_multi(fp_pcr_reset_multi);
+
 // functions to implement only for tpm2
 
 #define FP_ctx_setalg(x)				\
@@ -138,6 +178,80 @@ typedef FP_ctx_setalg(fp_ctx_setalg);
 	       const void* selection)
 typedef FP_pcr_setalg(fp_pcr_setalg);
 
+/*
+ * send an extend as pcr_extend_multi does, without reading the new values
+ * back nor waiting for the tpm to execute it, which is left to the next
+ * command sent, or to pcr_finish. it returns what the extend sent before
+ * (if any) ended with, and the new one is not sent if that failed.
+ */
+#define FP_pcr_extend_async(x) uint32_t (x)(pcr_context_base* ctx,	\
+					    uint32_t pcr_index,		\
+					    const uint32_t* algs,	\
+					    size_t nalg,		\
+					    const char* data,		\
+					    const uint32_t* datalen)
+typedef FP_pcr_extend_async(fp_pcr_extend_async);
+
+// wait for the command sent asynchronously to complete, if any.
+#define FP_pcr_finish(x) uint32_t (x)(pcr_context_base* ctx)
+typedef FP_pcr_finish(fp_pcr_finish);
+
+/*
+ * read as pcr_read_multi does, also giving the pcrUpdateCounter all the
+ * values are read at, so that an unchanged counter later tells none of
+ * them changed meanwhile (but those of PCR_UNCOUNTED, whose updates may
+ * not be counted). with a pcr_mask of 0, only the counter is read, in a
+ * single command.
+ */
+#define FP_pcr_read_counter(x) uint32_t (x)(pcr_context_base* ctx,	\
+					    const uint32_t* algs,	\
+					    size_t nalg,		\
+					    uint32_t pcr_mask,		\
+					    pcr* pcrvalues,		\
+					    uint32_t* counter)
+typedef FP_pcr_read_counter(fp_pcr_read_counter);
+
+/*
+ * pcrs whose updates may leave pcrUpdateCounter as it is. the tpm tells
+ * which ones in TPM_PT_PCR_NO_INCREMENT, e.g. 20-22 on the reference
+ * implementation, but they are all among 16-23 on the tpms of pc clients,
+ * so all of these are taken as uncounted.
+ */
+#define PCR_UNCOUNTED 0x00ff0000u
+
+#define QUOTE_MAX_ATTEST 1024
+#define QUOTE_MAX_SIG 512
+
+/*
+ * a quote as TPM2_Quote returns it: the TPMS_ATTEST signed, as marshaled
+ * by the tpm, and the signature of the scheme sig_alg (a TPM_ALG_ id) with
+ * the digest hash_alg, which is also the one of pcrDigest in the attest.
+ * an ecdsa signature holds r then s, of half of sig_size each.
+ */
+typedef struct pcr_quote {
+  uint32_t sig_alg;
+  uint32_t hash_alg;
+  size_t attest_size;
+  char attest[QUOTE_MAX_ATTEST];
+  size_t sig_size;
+  char sig[QUOTE_MAX_SIG];
+} pcr_quote;
+
+/*
+ * quote the pcrs of pcr_mask on each bank of algs (as pcr_read_multi takes
+ * them) with the loaded signing key at key_handle, in a single command,
+ * with nonce as the qualifying data.
+ */
+#define FP_pcr_quote(x) uint32_t (x)(pcr_context_base* ctx,		\
+				     uint32_t key_handle,		\
+				     const uint32_t* algs,		\
+				     size_t nalg,			\
+				     uint32_t pcr_mask,			\
+				     const char* nonce,			\
+				     size_t nonce_len,			\
+				     pcr_quote* quote)
+typedef FP_pcr_quote(fp_pcr_quote);
+
 typedef struct tpm2_spec_vtbl tpm2_spec_vtbl;
 
 struct pcr_vtbl {
@@ -151,11 +265,21 @@ struct pcr_vtbl {
   fp_pcr_read* pcr_read;
   fp_pcr_extend* pcr_extend;
   fp_pcr_reset* pcr_reset;
+  fp_pcr_read_multi* pcr_read_multi;
+  fp_pcr_extend_multi* pcr_extend_multi;
+  fp_pcr_reset_multi* pcr_reset_multi;
 };
 
 struct tpm2_spec_vtbl {
   fp_ctx_setalg* ctx_setalg;
   fp_pcr_setalg* pcr_setalg;
+  // optional, extends are done synchronously without them.
+  fp_pcr_extend_async* pcr_extend_async;
+  fp_pcr_finish* pcr_finish;
+  // optional, pcrs are not cached without it.
+  fp_pcr_read_counter* pcr_read_counter;
+  // optional, for tpms holding keys.
+  fp_pcr_quote* pcr_quote;
 };
 
 static inline bool vtbl_isvalid(const pcr_vtbl* t)
@@ -167,7 +291,10 @@ static inline bool vtbl_isvalid(const pcr_vtbl* t)
 	  && t->ctx_freemem
 	  && t->pcr_read
 	  && t->pcr_extend
-	  && t->pcr_reset);
+	  && t->pcr_reset
+	  && t->pcr_read_multi
+	  && t->pcr_extend_multi
+	  && t->pcr_reset_multi);
 }
 
 static inline int tpm_errout(const pcr_context_base* ctx,
@@ -202,6 +329,15 @@ static inline FP_pcr_read(tpm_pcr_read)
 			     pcrvalue);
 }
 
+static inline FP_pcr_read_multi(tpm_pcr_read_multi)
+{
+  return ctx->vtbl->pcr_read_multi(ctx,
+				   algs,
+				   nalg,
+				   pcr_mask,
+				   pcrvalues);
+}
+
 static inline FP_pcr_extend(tpm_pcr_extend)
 {
   return ctx->vtbl->pcr_extend(ctx,
@@ -211,11 +347,27 @@ static inline FP_pcr_extend(tpm_pcr_extend)
 			       newvalue);
 }
 
+static inline FP_pcr_extend_multi(tpm_pcr_extend_multi)
+{
+  return ctx->vtbl->pcr_extend_multi(ctx,
+				     pcr_index,
+				     algs,
+				     nalg,
+				     data,
+				     datalen,
+				     newvalues);
+}
+
 static inline FP_pcr_reset(tpm_pcr_reset)
 {
   return ctx->vtbl->pcr_reset(ctx, pcr_index);
 }
 
+static inline FP_pcr_reset_multi(tpm_pcr_reset_multi)
+{
+  return ctx->vtbl->pcr_reset_multi(ctx, pcr_mask);
+}
+
 static inline FP_pcr_setalg(tpm_pcr_setalg)
 {
   return ((ctx->vtbl->vt2)?
@@ -223,6 +375,67 @@ static inline FP_pcr_setalg(tpm_pcr_setalg)
 	  0);
 }
 
+static inline FP_pcr_extend_async(tpm_pcr_extend_async)
+{
+  return ((ctx->vtbl->vt2 && ctx->vtbl->vt2->pcr_extend_async)?
+	  ctx->vtbl->vt2->pcr_extend_async(ctx,
+					   pcr_index,
+					   algs,
+					   nalg,
+					   data,
+					   datalen):
+	  tpm_pcr_extend_multi(ctx,
+			       pcr_index,
+			       algs,
+			       nalg,
+			       data,
+			       datalen,
+			       NULL));
+}
+
+static inline FP_pcr_finish(tpm_pcr_finish)
+{
+  return ((ctx->vtbl->vt2 && ctx->vtbl->vt2->pcr_finish)?
+	  ctx->vtbl->vt2->pcr_finish(ctx):
+	  0);
+}
+
+static inline bool tpm_has_update_counter(const pcr_context_base* ctx)
+{
+  return (ctx->vtbl->vt2 && ctx->vtbl->vt2->pcr_read_counter);
+}
+
+// only for a ctx which tpm_has_update_counter().
+static inline FP_pcr_read_counter(tpm_pcr_read_counter)
+{
+  assert(tpm_has_update_counter(ctx));
+  return ctx->vtbl->vt2->pcr_read_counter(ctx,
+					  algs,
+					  nalg,
+					  pcr_mask,
+					  pcrvalues,
+					  counter);
+}
+
+static inline bool tpm_has_quote(const pcr_context_base* ctx)
+{
+  return (ctx->vtbl->vt2 && ctx->vtbl->vt2->pcr_quote);
+}
+
+// only for a ctx which tpm_has_quote().
+static inline FP_pcr_quote(tpm_pcr_quote)
+{
+  assert(tpm_has_quote(ctx));
+  return ctx->vtbl->vt2->pcr_quote(ctx,
+				   key_handle,
+				   algs,
+				   nalg,
+				   pcr_mask,
+				   nonce,
+				   nonce_len,
+				   quote);
+}
+
 static inline FP_ctx_setalg(tpm_ctx_setalg)
 {
   if(ctx->vtbl->vt2) {
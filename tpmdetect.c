@@ -0,0 +1,134 @@
+/* 
+ * tpmdetect.c
+ * Find out the version of the tpm without connecting to it.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "tpmdetect.h"
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BOOT_ID "/proc/sys/kernel/random/boot_id"
+
+static bool read_line(const char* path, char* buf, size_t size)
+{
+  FILE* f = fopen(path, "r");
+  if(f == NULL)
+    return false;
+  bool ok = (fgets(buf, size, f) != NULL);
+  fclose(f);
+  if(ok)
+    buf[strcspn(buf, "\n")] = '\0';
+  return ok;
+}
+
+tpmdetect_result tpmdetect_sysfs(void)
+{
+  tpmdetect_result r = TPMDETECT_NONE;
+  glob_t g;
+  size_t i = 0;
+  if(glob("/sys/class/tpm/tpm[0-9]*", 0, NULL, &g) != 0)
+    return TPMDETECT_NONE;
+
+  for(; i < g.gl_pathc && r == TPMDETECT_NONE; i++) {
+    char path[256];
+    char line[16];
+    snprintf(path, sizeof(path), "%s/tpm_version_major", g.gl_pathv[i]);
+    if(read_line(path, line, sizeof(line))) {
+      if(0 == strcmp(line, "2"))
+	r = TPMDETECT_TPM2;
+      else if(0 == strcmp(line, "1"))
+	r = TPMDETECT_TPM12;
+      continue;
+    }
+    // kernels before 5.6 give the caps file to tpm1 chips only.
+    snprintf(path, sizeof(path), "%s/device/caps", g.gl_pathv[i]);
+    r = (access(path, R_OK) == 0)? TPMDETECT_TPM12: TPMDETECT_TPM2;
+  }
+  globfree(&g);
+  return r;
+}
+
+/*
+ * the file holds the version and the boot_id it is found on, as
+ * "2 <boot_id>", so it is not trusted after a reboot, even if /run is
+ * not cleared.
+ */
+tpmdetect_result tpmdetect_cached(const char* path)
+{
+  char line[64];
+  char boot[40];
+  int v = 0;
+  if(!read_line(path, line, sizeof(line))
+     || !read_line(BOOT_ID, boot, sizeof(boot)))
+    return TPMDETECT_NONE;
+  char* sp = strchr(line, ' ');
+  if(sp == NULL || 0 != strcmp(sp + 1, boot))
+    return TPMDETECT_NONE;
+  *sp = '\0';
+  if(0 == strcmp(line, "1.2"))
+    v = TPMDETECT_TPM12;
+  else if(0 == strcmp(line, "2"))
+    v = TPMDETECT_TPM2;
+  return (tpmdetect_result)v;
+}
+
+bool tpmdetect_save(const char* path, tpmdetect_result r)
+{
+  char boot[40];
+  char tmp[256];
+  if(r == TPMDETECT_NONE || !read_line(BOOT_ID, boot, sizeof(boot)))
+    return false;
+  if(snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid())
+     >= (int)sizeof(tmp))
+    return false;
+
+  // written aside and renamed, so readers never see half of it.
+  FILE* f = fopen(tmp, "w");
+  if(f == NULL)
+    return false;
+  bool ok = (fprintf(f, "%s %s\n", (r == TPMDETECT_TPM12)? "1.2": "2",
+		     boot) > 0);
+  ok = (fclose(f) == 0) && ok;
+  if(ok)
+    ok = (rename(tmp, path) == 0);
+  if(!ok)
+    unlink(tmp);
+  return ok;
+}
+
+bool tpmdetect_boot_id(char* buf, size_t size)
+{
+  return read_line(BOOT_ID, buf, size);
+}
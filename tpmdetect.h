@@ -0,0 +1,77 @@
+/* 
+ * tpmdetect.h
+ * Find out the version of the tpm without connecting to it.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _TPMDETECT_H_
+#define _TPMDETECT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Connecting to tcsd to find out there is no tpm1 costs every run on a
+ * machine with a tpm2. The kernel tells the version of its tpm in sysfs,
+ * in tpm_version_major since linux 5.6, and before that, only tpm1 chips
+ * have the caps file. What is found could be saved into a small file in
+ * /run, valid until the next boot, for the next runs to read instead.
+ */
+
+#define TPMDETECT_CACHE "/run/pcrtool.tpm"
+
+typedef enum tpmdetect_result {
+  TPMDETECT_NONE = 0,
+  TPMDETECT_TPM12,
+  TPMDETECT_TPM2,
+} tpmdetect_result;
+
+tpmdetect_result tpmdetect_sysfs(void);
+tpmdetect_result tpmdetect_cached(const char* path);
+bool tpmdetect_save(const char* path, tpmdetect_result r);
+// the boot_id of the kernel, for other caches to be valid until reboot.
+bool tpmdetect_boot_id(char* buf, size_t size);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif
@@ -0,0 +1,164 @@
+/* 
+ * workq.c
+ * a tiny pool of worker threads running indexed jobs, whose
+ * results are consumed in the order of their indices.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#include "workq.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef struct workq_worker {
+  workq* q;
+  size_t id;
+  pthread_t th;
+} workq_worker;
+
+struct workq {
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  fp_workq_job* job;
+  void* arg;
+  size_t num;
+  size_t next; // next index to hand out.
+  bool stop;
+  int* results;
+  bool* finished;
+  size_t nworkers;
+  workq_worker workers[];
+};
+
+static void* workq_thread(void* p)
+{
+  workq_worker* w = (workq_worker*)p;
+  workq* q = w->q;
+
+  pthread_mutex_lock(&q->lock);
+  while(!q->stop && q->next < q->num) {
+    size_t i = q->next ++;
+    pthread_mutex_unlock(&q->lock);
+
+    int r = q->job(q->arg, w->id, i);
+
+    pthread_mutex_lock(&q->lock);
+    q->results[i] = r;
+    q->finished[i] = true;
+    pthread_cond_broadcast(&q->done);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+workq* workq_new(size_t workers, size_t num, fp_workq_job* job, void* arg)
+{
+  if(workers == 0)
+    workers = 1;
+  if(workers > num && num > 0)
+    workers = num;
+
+  workq* q = (workq*)calloc(1, sizeof(workq) + workers * sizeof(workq_worker));
+  if(q == NULL)
+    return NULL;
+  q->job = job;
+  q->arg = arg;
+  q->num = num;
+  q->results = (int*)calloc(num + 1, sizeof(int));
+  q->finished = (bool*)calloc(num + 1, sizeof(bool));
+  if(q->results == NULL || q->finished == NULL) {
+    free(q->results);
+    free(q->finished);
+    free(q);
+    return NULL;
+  }
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->done, NULL);
+
+  if(workers == 1)
+    return q; // run jobs inside workq_wait().
+
+  {
+    size_t i = 0;
+    for(; i < workers; i++) {
+      q->workers[i].q = q;
+      q->workers[i].id = i;
+      if(0 != pthread_create(&q->workers[i].th, NULL,
+			     workq_thread, &q->workers[i]))
+	break;
+    }
+    q->nworkers = i; // go ahead with the threads we have got.
+    if(i == 0) {
+      workq_free(q);
+      return NULL;
+    }
+  }
+  return q;
+}
+
+size_t workq_workers(const workq* q)
+{
+  return (q->nworkers == 0)? 1: q->nworkers;
+}
+
+int workq_wait(workq* q, size_t index)
+{
+  int r = 0;
+  if(q->nworkers == 0)
+    return q->job(q->arg, 0, index);
+
+  pthread_mutex_lock(&q->lock);
+  while(!q->finished[index])
+    pthread_cond_wait(&q->done, &q->lock);
+  r = q->results[index];
+  pthread_mutex_unlock(&q->lock);
+  return r;
+}
+
+void workq_free(workq* q)
+{
+  if(q == NULL)
+    return;
+
+  pthread_mutex_lock(&q->lock);
+  q->stop = true; // jobs not yet handed out are dropped.
+  pthread_mutex_unlock(&q->lock);
+  {
+    size_t i = 0;
+    for(; i < q->nworkers; i++)
+      pthread_join(q->workers[i].th, NULL);
+  }
+  pthread_cond_destroy(&q->done);
+  pthread_mutex_destroy(&q->lock);
+  free(q->results);
+  free(q->finished);
+  free(q);
+}
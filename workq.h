@@ -0,0 +1,81 @@
+/* 
+ * workq.h
+ * a tiny pool of worker threads running indexed jobs, whose
+ * results are consumed in the order of their indices.
+ * 
+ *
+ * The program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * The program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA 
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations
+ * including the two.
+ *
+ * You must obey the GNU General Public License in all respects
+ * for all of the code used other than OpenSSL.  If you modify
+ * file(s) with this exception, you may extend this exception to your
+ * version of the file(s), but you are not obligated to do so.  If you
+ * do not wish to do so, delete this exception statement from your
+ * version.  If you delete this exception statement from all source
+ * files in the program, then also delete it here.
+ */
+
+#ifndef _WORKQ_H_
+#define _WORKQ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#if 0
+}
+#endif
+#endif
+
+#include <stddef.h>
+
+/*
+ * A workq runs jobs 0 .. num-1 with a number of worker threads, handing
+ * out indices in ascending order, so job i is likely to finish before job
+ * i+1 does. The consumer calls workq_wait() for each index in turn, and can
+ * go ahead as soon as the job it needs is finished, while the remaining
+ * ones are still running.
+ *
+ * A job is told which worker is running it, so per-thread state (e.g. a
+ * digest context) could be kept in an array indexed by worker. Results
+ * other than the returned int should be stored by the job itself, into
+ * an array indexed by index.
+ *
+ * With only one worker, no thread is created at all, and jobs are run
+ * by workq_wait() in the calling thread.
+ */
+
+typedef struct workq workq;
+
+#define FP_workq_job(x) int (x)(void* arg, size_t worker, size_t index)
+typedef FP_workq_job(fp_workq_job);
+
+workq* workq_new(size_t workers, size_t num, fp_workq_job* job, void* arg);
+size_t workq_workers(const workq* q);
+int workq_wait(workq* q, size_t index);
+void workq_free(workq* q);
+
+#ifdef __cplusplus
+#if 0
+{
+#endif
+}
+#endif
+
+#endif